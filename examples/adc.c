@@ -0,0 +1,34 @@
+#include <avrtos.h>
+
+#include <stdio.h>
+
+#define BLOCK_SIZE 20
+
+void sampler(void *arg) {
+  (void)arg;
+  const uint8_t pins[] = {A0, A1};
+
+  adc_scan_start(pins, 2, ADC_TRIGGER_TIMER1_COMPB, BLOCK_SIZE, 2);
+
+  for (;;) {
+    uint16_t block[BLOCK_SIZE];
+    if (adc_scan_read(block, MAX_DELAY)) {
+      uint32_t sum[2] = {0, 0};
+      for (uint8_t i = 0; i < BLOCK_SIZE; i++) {
+        sum[i % 2] += block[i];
+      }
+      print("A0: %lu A1: %lu\n", sum[0] / (BLOCK_SIZE / 2),
+            sum[1] / (BLOCK_SIZE / 2));
+    }
+  }
+}
+
+int main(void) {
+  uart_init();
+  adc_init(ADC_REF_AVCC);
+
+  task_init(sampler, NULL, "sampler", 192, 1);
+
+  scheduler_init();
+  return 0;
+}
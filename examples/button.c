@@ -0,0 +1,30 @@
+#include <avrtos.h>
+
+#include <stdio.h>
+
+#define BUTTON_PIN 2
+#define LED_PIN 13
+
+void button(void *arg) {
+  (void)arg;
+
+  for (;;) {
+    gpio_event_t event;
+    if (gpio_irq_wait(BUTTON_PIN, &event, MAX_DELAY)) {
+      gpio_pin_toggle_fast(LED_PIN);
+      print("Pressed at tick %u (+%u)\n", event.tick, event.time);
+    }
+  }
+}
+
+int main(void) {
+  uart_init();
+  gpio_set_pin_mode(LED_PIN, OUTPUT);
+  gpio_set_pin_mode(BUTTON_PIN, INPUT_PULLUP);
+  gpio_irq_attach(BUTTON_PIN, GPIO_EDGE_FALLING, 50, NULL);
+
+  task_init(button, NULL, "button", 128, 2);
+
+  scheduler_init();
+  return 0;
+}
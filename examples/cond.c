@@ -0,0 +1,49 @@
+#include <avrtos.h>
+
+#include <stdio.h>
+
+semaphore_t lock;
+cond_t not_empty;
+uint8_t items;
+
+void consumer(void *arg) {
+  uint8_t id = (uintptr_t)arg;
+
+  for (;;) {
+    semaphore_take(lock, MAX_DELAY);
+    while (items == 0) {
+      if (!cond_wait(not_empty, lock, 1000)) {
+        print("Consumer %u: Timed out\n", id);
+      }
+    }
+    items--;
+    semaphore_give(lock);
+    print("Consumer %u: Took an item\n", id);
+  }
+}
+
+void producer(void *arg) {
+  (void)arg;
+
+  for (;;) {
+    semaphore_take(lock, MAX_DELAY);
+    items++;
+    cond_signal(not_empty);
+    semaphore_give(lock);
+    print("Producer: Added an item\n");
+    task_delay(1500);
+  }
+}
+
+int main(void) {
+  uart_init();
+  lock = semaphore_init(1);
+  not_empty = cond_init();
+
+  task_init(consumer, (void *)1, "consumer 1", 128, 2);
+  task_init(consumer, (void *)2, "consumer 2", 128, 1);
+  task_init(producer, NULL, "producer", 128, 1);
+
+  scheduler_init();
+  return 0;
+}
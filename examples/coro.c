@@ -0,0 +1,65 @@
+#include <avrtos.h>
+
+#include <stdio.h>
+
+#define LED_PIN 13
+
+queue_t presses;
+
+coro_status blink(coro_t coro, void *arg) {
+  (void)arg;
+
+  CORO_BEGIN(coro);
+  for (;;) {
+    gpio_pin_toggle_fast(LED_PIN);
+    CORO_DELAY(coro, 500);
+  }
+  CORO_END(coro);
+}
+
+coro_status counter(coro_t coro, void *arg) {
+  uint8_t *count = arg;
+  bool sent;
+
+  CORO_BEGIN(coro);
+  for (*count = 0; *count < 10; (*count)++) {
+    CORO_QUEUE_SEND(coro, presses, count, 100, sent);
+    if (!sent) {
+      print("Queue full, dropped %u\n", *count);
+    }
+    CORO_DELAY(coro, 300);
+  }
+  CORO_END(coro);
+}
+
+coro_status reporter(coro_t coro, void *arg) {
+  static uint8_t value;
+  bool received;
+  (void)arg;
+
+  CORO_BEGIN(coro);
+  for (;;) {
+    CORO_QUEUE_RECEIVE(coro, presses, &value, 2000, received);
+    if (received) {
+      print("Received %u\n", value);
+    } else {
+      print("No message for 2 seconds\n");
+    }
+  }
+  CORO_END(coro);
+}
+
+int main(void) {
+  static uint8_t count;
+
+  uart_init();
+  gpio_set_pin_mode(LED_PIN, OUTPUT);
+  presses = queue_init(4, sizeof(uint8_t));
+
+  coro_init(blink, NULL, 1);
+  coro_init(counter, &count, 1);
+  coro_init(reporter, NULL, 2);
+
+  scheduler_init();
+  return 0;
+}
@@ -0,0 +1,52 @@
+#include <avrtos.h>
+
+#include <stdio.h>
+
+#if !AVRTOS_SCHED_EDF
+#error "Build with make CONFIG=-DAVRTOS_SCHED_EDF=1"
+#endif
+
+typedef struct job {
+  uint16_t work; ///< Iterations of busy work in a period
+  uint16_t deadline;
+  uint16_t period;
+} job_t;
+
+volatile uint16_t sink;
+
+void periodic(void *arg) {
+  job_t *job = arg;
+  task_set_deadline(NULL, job->deadline, job->period);
+
+  for (;;) {
+    for (uint16_t i = 0; i < job->work; i++) {
+      sink++;
+    }
+    task_wait_period();
+  }
+}
+
+void report(void *arg) {
+  task_t *tasks = arg;
+
+  for (;;) {
+    print("Misses: fast %u, slow %u\n", task_deadline_misses(tasks[0]),
+          task_deadline_misses(tasks[1]));
+    task_delay(2000);
+  }
+}
+
+int main(void) {
+  static job_t fast = {2000, 50, 50};
+  static job_t slow = {8000, 200, 200};
+  static task_t tasks[2];
+
+  uart_init();
+
+  tasks[0] = task_init(periodic, &fast, "fast", 128, 1);
+  tasks[1] = task_init(periodic, &slow, "slow", 128, 1);
+  task_init(report, tasks, "report", 128, 1);
+
+  scheduler_init();
+  return 0;
+}
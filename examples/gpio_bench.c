@@ -0,0 +1,72 @@
+#include <avrtos.h>
+
+#include <stdio.h>
+
+#define BENCH_PIN 13
+#define TOGGLES 1000
+
+/**
+ * @brief Timer 1 counts since start, the timer wraps every tick
+ *
+ */
+static uint16_t elapsed(uint16_t start) {
+  uint16_t now = TCNT1;
+  return (now >= start) ? now - start : now + OCR1A + 1 - start;
+}
+
+/**
+ * @brief Print the time of a toggle and the resulting square wave frequency,
+ * a timer 1 count is 0.5us
+ *
+ */
+static void report(const char *name, uint16_t counts) {
+  uint32_t ns = (uint32_t)counts * 500 / TOGGLES;
+  uint32_t hz = (uint32_t)TOGGLES * 1000000UL / counts;
+  print("%s: %lu ns per toggle, %lu Hz\n", name, ns, hz);
+}
+
+void bench(void *arg) {
+  (void)arg;
+
+  for (;;) {
+    uint16_t start;
+    uint16_t write, write_fast, toggle_fast;
+
+    uint8_t sreg = critical_enter();
+
+    start = TCNT1;
+    for (uint16_t i = 0; i < TOGGLES; i++) {
+      gpio_pin_write(BENCH_PIN, i & 1);
+    }
+    write = elapsed(start);
+
+    start = TCNT1;
+    for (uint16_t i = 0; i < TOGGLES; i++) {
+      gpio_pin_write_fast(BENCH_PIN, i & 1);
+    }
+    write_fast = elapsed(start);
+
+    start = TCNT1;
+    for (uint16_t i = 0; i < TOGGLES; i++) {
+      gpio_pin_toggle_fast(BENCH_PIN);
+    }
+    toggle_fast = elapsed(start);
+
+    critical_exit(sreg);
+
+    report("gpio_pin_write", write);
+    report("gpio_pin_write_fast", write_fast);
+    report("gpio_pin_toggle_fast", toggle_fast);
+    task_delay(5000);
+  }
+}
+
+int main(void) {
+  uart_init();
+  gpio_set_pin_mode(BENCH_PIN, OUTPUT);
+
+  task_init(bench, NULL, "gpio bench", 128, 1);
+
+  scheduler_init();
+  return 0;
+}
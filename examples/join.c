@@ -0,0 +1,37 @@
+#include <avrtos.h>
+
+#include <stdio.h>
+
+void measure(void *arg) {
+  uint16_t *result = arg;
+  task_delay(100);
+  *result += 1;
+}
+
+void spawner(void *arg) {
+  (void)arg;
+  uint16_t result = 0;
+
+  for (;;) {
+    task_t worker = task_init(measure, &result, "worker", 96, 1);
+    if (worker == NULL) {
+      print("Spawner: Out of memory\n");
+    } else if (task_join(worker, 1000)) {
+      print("Spawner: Worker ended, result %u\n", result);
+    } else {
+      print("Spawner: Worker timed out\n");
+      task_destroy(worker);
+      task_detach(worker);
+    }
+    task_delay(500);
+  }
+}
+
+int main(void) {
+  uart_init();
+
+  task_init(spawner, NULL, "spawner", 128, 2);
+
+  scheduler_init();
+  return 0;
+}
@@ -0,0 +1,64 @@
+#include <avrtos.h>
+
+#include <stdio.h>
+
+#define SAMPLES 100
+
+semaphore_t sem;
+volatile uint16_t given_at;
+
+/**
+ * @brief Timer 1 counts since start, the timer wraps every tick
+ *
+ */
+static uint16_t elapsed(uint16_t start) {
+  uint16_t now = TCNT1;
+  return (now >= start) ? now - start : now + OCR1A + 1 - start;
+}
+
+void waiter(void *arg) {
+  (void)arg;
+
+  for (;;) {
+    uint16_t min = UINT16_MAX;
+    uint16_t max = 0;
+    uint32_t total = 0;
+
+    for (uint8_t i = 0; i < SAMPLES; i++) {
+      semaphore_take(sem, MAX_DELAY);
+      uint16_t latency = elapsed(given_at);
+      total += latency;
+      if (latency < min) {
+        min = latency;
+      }
+      if (latency > max) {
+        max = latency;
+      }
+    }
+
+    // A timer 1 count is 0.5us
+    print("Give to run latency: min %u us, avg %lu us, max %u us\n", min / 2,
+          total / SAMPLES / 2, max / 2);
+  }
+}
+
+void giver(void *arg) {
+  (void)arg;
+
+  for (;;) {
+    task_delay(30);
+    given_at = TCNT1;
+    semaphore_give(sem);
+  }
+}
+
+int main(void) {
+  uart_init();
+  sem = semaphore_init(0);
+
+  task_init(waiter, NULL, "waiter", 128, 2);
+  task_init(giver, NULL, "giver", 96, 1);
+
+  scheduler_init();
+  return 0;
+}
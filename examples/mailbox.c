@@ -0,0 +1,55 @@
+#include <avrtos.h>
+
+#include <stdio.h>
+
+mailbox_t mailbox;
+
+void sensor(void *arg) {
+  (void)arg;
+  int reading = 0;
+
+  for (;;) {
+    mailbox_write(mailbox, &reading);
+    reading++;
+    task_delay(100);
+  }
+}
+
+void poller(void *arg) {
+  (void)arg;
+
+  for (;;) {
+    int reading;
+    uint16_t version = mailbox_read(mailbox, &reading);
+    print("Poller: %d (version %u)\n", reading, version);
+    task_delay(1000);
+  }
+}
+
+void waiter(void *arg) {
+  (void)arg;
+  uint16_t version = 0;
+
+  for (;;) {
+    if (mailbox_wait_newer(mailbox, version, 500)) {
+      int reading;
+      version = mailbox_read(mailbox, &reading);
+      print("Waiter: %d\n", reading);
+    } else {
+      print("Waiter: No new reading\n");
+    }
+    task_delay(300);
+  }
+}
+
+int main(void) {
+  uart_init();
+  mailbox = mailbox_init(sizeof(int));
+
+  task_init(sensor, NULL, "sensor", 128, 2);
+  task_init(poller, NULL, "poller", 128, 1);
+  task_init(waiter, NULL, "waiter", 128, 1);
+
+  scheduler_init();
+  return 0;
+}
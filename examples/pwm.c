@@ -0,0 +1,32 @@
+#include <avrtos.h>
+
+void fade(void *arg) {
+  uint8_t pin = *(uint8_t *)arg;
+  uint8_t duty = 0;
+  int8_t step = 5;
+
+  pwm_enable(pin);
+
+  for (;;) {
+    pwm_write(pin, duty);
+    if (duty == 0) {
+      step = 5;
+    } else if (duty == 255) {
+      step = -5;
+    }
+    duty += step;
+    task_delay(20);
+  }
+}
+
+int main(void) {
+  static uint8_t pin = 6;
+
+  // 16 MHz / 64 / 256 = 976 Hz
+  pwm_init(PWM_TIMER0, PWM_PRESCALER_64, 0xff);
+
+  task_init(fade, &pin, "fade", 96, 1);
+
+  scheduler_init();
+  return 0;
+}
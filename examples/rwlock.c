@@ -0,0 +1,50 @@
+#include <avrtos.h>
+
+#include <stdio.h>
+
+rwlock_t lock;
+uint16_t calibration[4];
+
+void reader(void *arg) {
+  uint8_t id = (uintptr_t)arg;
+
+  for (;;) {
+    if (rwlock_read_lock(lock, 500)) {
+      uint16_t sum = 0;
+      for (uint8_t i = 0; i < 4; i++) {
+        sum += calibration[i];
+      }
+      rwlock_read_unlock(lock);
+      print("Reader %u: Sum %u\n", id, sum);
+    } else {
+      print("Reader %u: Could not acquire\n", id);
+    }
+    task_delay(200);
+  }
+}
+
+void writer(void *arg) {
+  (void)arg;
+
+  for (;;) {
+    rwlock_write_lock(lock, MAX_DELAY);
+    for (uint8_t i = 0; i < 4; i++) {
+      calibration[i]++;
+    }
+    rwlock_write_unlock(lock);
+    print("Writer: Updated\n");
+    task_delay(2000);
+  }
+}
+
+int main(void) {
+  uart_init();
+  lock = rwlock_init();
+
+  task_init(reader, (void *)1, "reader 1", 128, 1);
+  task_init(reader, (void *)2, "reader 2", 128, 1);
+  task_init(writer, NULL, "writer", 128, 2);
+
+  scheduler_init();
+  return 0;
+}
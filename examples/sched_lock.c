@@ -0,0 +1,50 @@
+#include <avrtos.h>
+
+#include <stdio.h>
+
+typedef struct position {
+  int16_t x;
+  int16_t y;
+} position_t;
+
+position_t position;
+
+void writer(void *arg) {
+  (void)arg;
+
+  for (int16_t i = 0;; i++) {
+    // Both fields change together, readers never see a half update
+    scheduler_lock();
+    position.x = i;
+    position.y = -i;
+    scheduler_unlock();
+    task_delay(10);
+  }
+}
+
+void reader(void *arg) {
+  (void)arg;
+
+  for (;;) {
+    scheduler_lock();
+    position_t copy = position;
+    scheduler_unlock();
+
+    if (copy.x != -copy.y) {
+      print("Torn read %d %d\n", copy.x, copy.y);
+    } else {
+      print("Position %d %d\n", copy.x, copy.y);
+    }
+    task_delay(500);
+  }
+}
+
+int main(void) {
+  uart_init();
+
+  task_init(writer, NULL, "writer", 96, 1);
+  task_init(reader, NULL, "reader", 128, 1);
+
+  scheduler_init();
+  return 0;
+}
@@ -0,0 +1,43 @@
+#include <avrtos.h>
+
+#include <stdio.h>
+
+#define FLASH_CS 9
+
+void flash_id(void *arg) {
+  (void)arg;
+  const uint8_t command[4] = {0x9f, 0, 0, 0};
+
+  for (;;) {
+    uint8_t id[4];
+    if (spi_transfer(FLASH_CS, command, id, sizeof(id), 100)) {
+      print("JEDEC ID: %02x %02x %02x\n", id[1], id[2], id[3]);
+    } else {
+      print("SPI timeout\n");
+    }
+    task_delay(1000);
+  }
+}
+
+void blink(void *arg) {
+  (void)arg;
+
+  for (;;) {
+    gpio_pin_toggle_fast(8);
+    task_delay(250);
+  }
+}
+
+int main(void) {
+  uart_init();
+  gpio_set_pin_mode(FLASH_CS, OUTPUT);
+  gpio_pin_write(FLASH_CS, HIGH);
+  gpio_set_pin_mode(8, OUTPUT);
+  spi_init(SPI_MODE0, SPI_CLOCK_DIV4);
+
+  task_init(flash_id, NULL, "flash", 128, 1);
+  task_init(blink, NULL, "blink", 96, 1);
+
+  scheduler_init();
+  return 0;
+}
@@ -0,0 +1,78 @@
+#include <avrtos.h>
+
+#include <stdio.h>
+
+#define LED_PIN 13
+
+task_t logger_task;
+task_t worker_task;
+
+void control(void *arg) {
+  (void)arg;
+
+  for (;;) {
+    gpio_pin_toggle_fast(LED_PIN);
+    task_delay(100);
+  }
+}
+
+void worker(void *arg) {
+  (void)arg;
+
+  for (;;) {
+    // Background work which can take all the idle time
+    for (volatile uint16_t i = 0; i < 20000; i++)
+      ;
+    task_delay(10);
+  }
+}
+
+void logger(void *arg) {
+  (void)arg;
+
+  for (uint16_t i = 0;; i++) {
+    print("Log line %u\n", i);
+    task_delay(200);
+  }
+}
+
+void supervisor(void *arg) {
+  (void)arg;
+  scheduler_stats_t last;
+  scheduler_stats(&last);
+
+  for (;;) {
+    task_delay(1000);
+
+    scheduler_stats_t stats;
+    scheduler_stats(&stats);
+    tick_t ticks = stats.ticks - last.ticks;
+    tick_t idle = stats.idle_ticks - last.idle_ticks;
+    last = stats;
+
+    uint8_t load = 100 - (uint32_t)idle * 100 / ticks;
+    if (load > 90) {
+      // Overloaded, drop the log and push the worker behind everything
+      task_suspend(logger_task);
+      task_set_priority(worker_task, 0);
+    } else if (load < 50) {
+      task_resume(logger_task);
+      task_set_priority(worker_task, 2);
+    }
+    print("Load %u%%, worker priority %u\n", load,
+          task_get_priority(worker_task));
+  }
+}
+
+int main(void) {
+  uart_init();
+  gpio_set_pin_mode(LED_PIN, OUTPUT);
+
+  task_init(control, NULL, "control", 96, 4);
+  task_init(supervisor, NULL, "supervisor", 160, 3);
+  worker_task = task_init(worker, NULL, "worker", 96, 2);
+  logger_task = task_init(logger, NULL, "logger", 128, 1);
+
+  scheduler_init();
+  return 0;
+}
@@ -0,0 +1,51 @@
+#include <avrtos.h>
+
+#include <stdio.h>
+
+#define ROUNDS 100
+
+/**
+ * @brief Timer 1 counts since start, the timer wraps every tick
+ *
+ */
+static uint16_t elapsed(uint16_t start) {
+  uint16_t now = TCNT1;
+  return (now >= start) ? now - start : now + OCR1A + 1 - start;
+}
+
+void ping(void *arg) {
+  (void)arg;
+
+  for (;;) {
+    // Each round switches to pong and back
+    uint16_t start = TCNT1;
+    for (uint8_t i = 0; i < ROUNDS; i++) {
+      task_yield();
+    }
+    uint16_t counts = elapsed(start);
+
+    // A timer 1 count is 0.5us
+    print("%s: %u ns per switch\n",
+          AVRTOS_COOPERATIVE ? "Cooperative" : "Preemptive",
+          (uint16_t)((uint32_t)counts * 500 / (2 * ROUNDS)));
+    task_delay(1000);
+  }
+}
+
+void pong(void *arg) {
+  (void)arg;
+
+  for (;;) {
+    task_yield();
+  }
+}
+
+int main(void) {
+  uart_init();
+
+  task_init(ping, NULL, "ping", 128, 1);
+  task_init(pong, NULL, "pong", 64, 1);
+
+  scheduler_init();
+  return 0;
+}
@@ -0,0 +1,76 @@
+#include <avrtos.h>
+
+#include <stdio.h>
+
+#define LED_PIN 13
+
+typedef struct reading {
+  uint16_t value;
+  uint16_t sequence;
+} reading_t;
+
+topic_t readings;
+
+void sampler(void *arg) {
+  (void)arg;
+
+  for (uint16_t sequence = 0;; sequence++) {
+    reading_t reading = {0, sequence};
+    adc_read(A0, &reading.value, MAX_DELAY);
+    topic_publish(readings, &reading);
+    task_delay(100);
+  }
+}
+
+void logger(void *arg) {
+  subscriber_t sub = topic_subscribe(readings);
+  (void)arg;
+
+  for (;;) {
+    reading_t reading;
+    topic_receive(sub, &reading, MAX_DELAY);
+    print("Reading %u: %u\n", reading.sequence, reading.value);
+  }
+}
+
+void threshold(void *arg) {
+  subscriber_t sub = topic_subscribe(readings);
+  (void)arg;
+
+  for (;;) {
+    reading_t reading;
+    if (!topic_receive(sub, &reading, 1000)) {
+      print("Sampler stopped\n");
+      continue;
+    }
+    gpio_pin_write(LED_PIN, reading.value > 512);
+  }
+}
+
+void slow(void *arg) {
+  subscriber_t sub = topic_subscribe(readings);
+  (void)arg;
+
+  for (;;) {
+    reading_t reading;
+    topic_receive(sub, &reading, MAX_DELAY);
+    print("Slow subscriber at %u, dropped %u\n", reading.sequence,
+          topic_dropped(sub));
+    task_delay(2000);
+  }
+}
+
+int main(void) {
+  uart_init();
+  adc_init(ADC_REF_AVCC);
+  gpio_set_pin_mode(LED_PIN, OUTPUT);
+  readings = topic_init(8, sizeof(reading_t));
+
+  task_init(sampler, NULL, "sampler", 128, 3);
+  task_init(logger, NULL, "logger", 160, 1);
+  task_init(threshold, NULL, "threshold", 128, 2);
+  task_init(slow, NULL, "slow", 160, 1);
+
+  scheduler_init();
+  return 0;
+}
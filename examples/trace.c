@@ -0,0 +1,50 @@
+#include <avrtos.h>
+
+#include <stdio.h>
+
+#if !AVRTOS_USE_TRACE
+#error "Build with make CONFIG=-DAVRTOS_USE_TRACE=1"
+#endif
+
+semaphore_t sem;
+
+void consumer(void *arg) {
+  (void)arg;
+
+  for (;;) {
+    semaphore_take(sem, MAX_DELAY);
+    trace_user(1, TCNT1);
+  }
+}
+
+void producer(void *arg) {
+  (void)arg;
+
+  for (;;) {
+    semaphore_give(sem);
+    task_delay(30);
+  }
+}
+
+void tracer(void *arg) {
+  (void)arg;
+
+  for (;;) {
+    trace_start(TRACE_SNAPSHOT);
+    task_delay(200);
+    trace_dump(); // Convert with tools/trace2json.py
+    task_delay(5000);
+  }
+}
+
+int main(void) {
+  uart_init();
+  sem = semaphore_init(0);
+
+  task_init(consumer, NULL, "consumer", 128, 2);
+  task_init(producer, NULL, "producer", 128, 1);
+  task_init(tracer, NULL, "tracer", 128, 3);
+
+  scheduler_init();
+  return 0;
+}
@@ -0,0 +1,56 @@
+#include <avrtos.h>
+
+#include <stdio.h>
+
+#if !AVRTOS_USE_TT
+#error "Build with make CONFIG=-DAVRTOS_USE_TT=1"
+#endif
+
+#define SAMPLE_PIN 8
+#define CONTROL_PIN 9
+#define LED_PIN 13
+
+#define FRAMES 10 ///< Major cycle of 100 ms
+
+static volatile uint16_t samples;
+static volatile uint16_t steps;
+
+void sample(void) {
+  gpio_pin_toggle_fast(SAMPLE_PIN);
+  samples++;
+}
+
+void control(void) {
+  gpio_pin_toggle_fast(CONTROL_PIN);
+  steps++;
+}
+
+void blink(void) { gpio_pin_toggle_fast(LED_PIN); }
+
+static const tt_slot_t schedule[] PROGMEM = {
+    {0, sample}, {0, control}, {2, sample}, {4, sample},
+    {5, control}, {6, sample}, {8, sample}, {9, blink},
+};
+
+void report(void *arg) {
+  (void)arg;
+
+  for (;;) {
+    print("Samples %u, control steps %u, overruns %u\n", samples, steps,
+          tt_overruns());
+    task_delay(1000);
+  }
+}
+
+int main(void) {
+  uart_init();
+  gpio_set_pin_mode(SAMPLE_PIN, OUTPUT);
+  gpio_set_pin_mode(CONTROL_PIN, OUTPUT);
+  gpio_set_pin_mode(LED_PIN, OUTPUT);
+
+  tt_init(schedule, sizeof(schedule) / sizeof(schedule[0]), FRAMES, 96);
+  task_init(report, NULL, "report", 192, 1);
+
+  scheduler_init();
+  return 0;
+}
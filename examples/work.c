@@ -0,0 +1,45 @@
+#include <avrtos.h>
+
+#include <stdio.h>
+
+#define BUTTON_PIN 2
+#define LED_PIN 13
+
+static uint16_t presses;
+
+void count_press(void *arg) {
+  (void)arg;
+  presses++;
+  gpio_pin_toggle_fast(LED_PIN);
+  print("Pressed %u times\n", presses);
+}
+
+void button_callback(const gpio_event_t *event) {
+  (void)event;
+  work_submit(count_press, NULL);
+}
+
+void report(void *arg) {
+  (void)arg;
+
+  for (;;) {
+    work_stats_t stats;
+    work_stats(&stats);
+    print("Work queue depth %u, high water %u, drops %u\n", stats.depth,
+          stats.high_water, stats.drops);
+    task_delay(5000);
+  }
+}
+
+int main(void) {
+  uart_init();
+  gpio_set_pin_mode(LED_PIN, OUTPUT);
+  gpio_set_pin_mode(BUTTON_PIN, INPUT_PULLUP);
+  gpio_irq_attach(BUTTON_PIN, GPIO_EDGE_FALLING, 50, button_callback);
+
+  work_init(3, 128);
+  task_init(report, NULL, "report", 128, 1);
+
+  scheduler_init();
+  return 0;
+}
@@ -5,6 +5,15 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include <avr/interrupt.h>
+#include <avr/io.h>
+
+#include "avrtos_config.h"
+
+#if AVRTOS_PROFILE_CRITICAL || AVRTOS_USE_TT
+#include <avr/pgmspace.h>
+#endif
+
 /**
  * @brief delay to indicate blocking call should suspend the task instead
  * without timeout
@@ -24,6 +33,7 @@ typedef enum task_state {
   READY,
   BLOCKED,
   SUSPENDED,
+  TERMINATED,
 } task_state_t;
 
 /**
@@ -43,8 +53,97 @@ typedef enum {
   INPUT_PULLDOWN,
 } gpio_pin_mode;
 
+/**
+ * @brief GPIO ports
+ *
+ */
+typedef enum {
+  GPIO_PORTB, ///< Pins 8 - 13
+  GPIO_PORTC, ///< Pins A0 - A5
+  GPIO_PORTD, ///< Pins 0 - 7
+} gpio_port;
+
 typedef struct task *task_t;
 
+#if AVRTOS_TICK_WIDTH == 32
+typedef uint32_t tick_t; ///< Tick count, 10ms each
+#else
+typedef uint16_t tick_t; ///< Tick count, 10ms each
+#endif
+
+/**
+ * @brief Longest critical section recorded by the profiler
+ *
+ */
+typedef struct critical_profile {
+  uint16_t max_time; ///< Duration in timer 1 counts (0.5us at 16 MHz)
+  const char *file;  ///< File of the section (in program memory, print with %S)
+  uint16_t line;     ///< Line of the section
+} critical_profile_t;
+
+#if AVRTOS_PROFILE_CRITICAL
+/**
+ * @brief Disable interrupts and return the previous status register. Critical
+ * sections can be nested, interrupts are enabled again only when the
+ * outermost one exits
+ *
+ */
+#define critical_enter() critical_enter_at(PSTR(__FILE__), __LINE__)
+
+/**
+ * @brief Enter a critical section and start measuring it if it is the
+ * outermost one
+ *
+ * @param file File of the critical section (in program memory)
+ * @param line Line of the critical section
+ * @return uint8_t Status register to pass to critical_exit
+ */
+uint8_t critical_enter_at(const char *file, uint16_t line);
+
+/**
+ * @brief Leave a critical section
+ *
+ * @param sreg Status register returned by critical_enter
+ */
+void critical_exit(uint8_t sreg);
+
+/**
+ * @brief Get the longest critical section recorded so far
+ *
+ * @param profile Profile to fill
+ */
+void critical_profile_get(critical_profile_t *profile);
+
+/**
+ * @brief Clear the recorded critical sections
+ *
+ */
+void critical_profile_reset(void);
+#else
+/**
+ * @brief Disable interrupts and return the previous status register. Critical
+ * sections can be nested, interrupts are enabled again only when the
+ * outermost one exits
+ *
+ * @return uint8_t Status register to pass to critical_exit
+ */
+static inline uint8_t critical_enter(void) {
+  uint8_t sreg = SREG;
+  cli();
+  return sreg;
+}
+
+/**
+ * @brief Leave a critical section by restoring the status register
+ *
+ * @param sreg Status register returned by critical_enter
+ */
+static inline void critical_exit(uint8_t sreg) {
+  asm volatile("" ::: "memory");
+  SREG = sreg;
+}
+#endif
+
 /**
  * @brief Create a task and put it into ready tasks queue
  *
@@ -58,6 +157,13 @@ typedef struct task *task_t;
 task_t task_init(void (*fn)(void *), void *arg, const char *name,
                  size_t stack_size, uint8_t priority);
 
+/**
+ * @brief Let the other ready tasks with the same or higher priority run
+ * before the running task continues
+ *
+ */
+void task_yield(void);
+
 /**
  * @brief Delay the task for specified milliseconds
  *
@@ -66,12 +172,110 @@ task_t task_init(void (*fn)(void *), void *arg, const char *name,
 void task_delay(uint16_t ms);
 
 /**
- * @brief Deallocate tasks recourses
+ * @brief End the task. Its resources are freed later by the idle task, once
+ * it is joined or detached. A task whose function returns ends the same way
+ *
+ * @warning This function does not return
+ */
+void task_exit(void);
+
+/**
+ * @brief End a task. Its resources are freed later by the idle task, once it
+ * is joined or detached. The running task can destroy itself
  *
  * @param task Task handle
  */
 void task_destroy(task_t task);
 
+/**
+ * @brief Wait until a task ends. An ended task is kept until it is joined, a
+ * successful join detaches it
+ *
+ * @warning The handle must not be used after a successful join or
+ * task_detach
+ *
+ * @param task Task handle
+ * @param timeout Time of block or MAX_DELAY for suspending
+ * @return true if the task ended
+ * @return false if timeout occurred, or task is NULL or the running task
+ */
+bool task_join(task_t task, uint16_t timeout);
+
+/**
+ * @brief Let the idle task free a task once it ends, without joining it
+ *
+ * @warning The handle must not be used after task_detach
+ *
+ * @param task Task handle, NULL for the running task
+ */
+void task_detach(task_t task);
+
+/**
+ * @brief Change the priority of a task in whichever queue it is. Switches at
+ * once if a ready task becomes higher than the running task. Can be called
+ * from ISRs
+ *
+ * @param task Task handle, NULL for the running task
+ * @param priority New priority
+ */
+void task_set_priority(task_t task, uint8_t priority);
+
+/**
+ * @brief Get the priority of a task
+ *
+ * @param task Task handle, NULL for the running task
+ * @return uint8_t
+ */
+uint8_t task_get_priority(task_t task);
+
+/**
+ * @brief Park a task until task_resume, whatever it was doing. A delay or
+ * wait the task was in ends early after it is resumed, waits check their
+ * condition again. Can be called from ISRs
+ *
+ * @warning A running task parked from an ISR or with interrupts disabled
+ * stops at the next switch. The idle task is never parked
+ *
+ * @param task Task handle, NULL for the running task
+ */
+void task_suspend(task_t task);
+
+/**
+ * @brief Resume a task parked by task_suspend. Can be called from ISRs
+ *
+ * @param task Task handle
+ */
+void task_resume(task_t task);
+
+#if AVRTOS_SCHED_EDF
+/**
+ * @brief Make the task periodic with a deadline. It is scheduled by earliest
+ * deadline first, ahead of all the tasks without a deadline. The first period
+ * starts now
+ *
+ * @param task Task handle, NULL for the running task
+ * @param deadline Milliseconds from the start of a period to its deadline
+ * @param period Milliseconds between the starts of periods
+ */
+void task_set_deadline(task_t task, uint16_t deadline, uint16_t period);
+
+/**
+ * @brief Finish the work of this period and wait for the next one. A miss is
+ * counted if the deadline has passed
+ *
+ */
+void task_wait_period(void);
+
+/**
+ * @brief Number of periods the task finished after their deadline
+ *
+ * @param task Task handle
+ * @return uint16_t
+ */
+uint16_t task_deadline_misses(task_t task);
+#endif
+
+#if AVRTOS_USE_SEMAPHORE
 typedef struct semaphore *semaphore_t;
 
 /**
@@ -106,7 +310,9 @@ void semaphore_give(semaphore_t sem);
  * @param sem Semaphore
  */
 void semaphore_destroy(semaphore_t sem);
+#endif
 
+#if AVRTOS_USE_QUEUE
 typedef struct queue *queue_t;
 
 /**
@@ -144,51 +350,1094 @@ bool queue_receive(queue_t queue, void *item, uint16_t timeout);
  * @param queue Queue to deallocate
  */
 void queue_destroy(queue_t queue);
+#endif
+
+#if AVRTOS_USE_MAILBOX
+typedef struct mailbox *mailbox_t;
 
 /**
- * @brief Start scheduler
+ * @brief Create a mailbox holding the latest written item
  *
- * @warning If initialization is successful this function does not return
+ * @param item_size Size of the item stored in mailbox
+ * @return mailbox_t
  */
-void scheduler_init(void);
+mailbox_t mailbox_init(uint8_t item_size);
 
 /**
- * @brief Initialize the UART driver
+ * @brief Overwrite the item in mailbox and wake the waiting tasks. Can be
+ * called from ISRs
  *
+ * @param mbox Mailbox
+ * @param item Item to write
  */
-void uart_init(void);
+void mailbox_write(mailbox_t mbox, const void *item);
 
 /**
- * @brief Set pin mode
+ * @brief Copy the latest item without blocking. Interrupts are disabled only
+ * to read the sequence counter, the copy is retried if a write happens in the
+ * middle of it
  *
- * @param pin
- * @param mode
+ * @param mbox Mailbox
+ * @param item Buffer to copy the item into
+ * @return uint16_t Version of the copied item, 0 if mailbox was never written
  */
-void gpio_set_pin_mode(uint8_t pin, gpio_pin_mode mode);
+uint16_t mailbox_read(mailbox_t mbox, void *item);
 
 /**
- * @brief Write low or high to a pin
+ * @brief Wait until the mailbox holds a newer item than version
  *
- * @param pin
- * @param value
+ * @param mbox Mailbox
+ * @param version Version returned by the last mailbox_read
+ * @param timeout Time of block or MAX_DELAY for suspending
+ * @return true
+ * @return false
  */
-void gpio_pin_write(uint8_t pin, uint8_t value);
+bool mailbox_wait_newer(mailbox_t mbox, uint16_t version, uint16_t timeout);
 
 /**
- * @brief Read the pin
+ * @brief Deallocate the resources of mailbox
  *
- * @param pin
- * @return uint8_t
+ * @param mbox Mailbox
  */
-uint8_t gpio_pin_read(uint8_t pin);
+void mailbox_destroy(mailbox_t mbox);
+#endif
+
+#if AVRTOS_USE_TOPIC
+typedef struct topic *topic_t;
+typedef struct subscriber *subscriber_t;
 
 /**
- * @brief Print to standard output
+ * @brief Create a topic keeping the last capacity published messages for
+ * its subscribers
  *
- * @param fmt Format string
- * @param ... Arguments
- * @return int
+ * @param capacity Number of messages kept
+ * @param item_size Size of messages
+ * @return topic_t, NULL if capacity is 0 or out of memory
  */
-int print(const char *fmt, ...);
+topic_t topic_init(uint8_t capacity, uint8_t item_size);
+
+/**
+ * @brief Subscribe to a topic. The subscriber receives the messages published
+ * after this call
+ *
+ * @param topic Topic
+ * @return subscriber_t
+ */
+subscriber_t topic_subscribe(topic_t topic);
+
+/**
+ * @brief Publish a message to every subscriber and wake the waiting ones. The
+ * message is copied once and the publisher never blocks, the oldest message
+ * is overwritten when the topic is full. Can be called from ISRs
+ *
+ * @param topic Topic
+ * @param item Message
+ */
+void topic_publish(topic_t topic, const void *item);
+
+/**
+ * @brief Receive the next message of the subscriber. Messages overwritten
+ * before the subscriber read them are skipped and counted as dropped
+ *
+ * @param sub Subscriber
+ * @param item Buffer to copy the message into
+ * @param timeout Time of block or MAX_DELAY for suspending
+ * @return true
+ * @return false
+ */
+bool topic_receive(subscriber_t sub, void *item, uint16_t timeout);
+
+/**
+ * @brief Number of messages the subscriber missed because it fell behind
+ *
+ * @param sub Subscriber
+ * @return uint16_t
+ */
+uint16_t topic_dropped(subscriber_t sub);
+
+/**
+ * @brief Deallocate a subscriber
+ *
+ * @param sub Subscriber
+ */
+void topic_unsubscribe(subscriber_t sub);
+
+/**
+ * @brief Deallocate the resources of topic. Its subscribers must be
+ * unsubscribed first
+ *
+ * @param topic Topic
+ */
+void topic_destroy(topic_t topic);
+#endif
+
+#if AVRTOS_USE_RWLOCK
+typedef struct rwlock *rwlock_t;
+
+/**
+ * @brief Create a reader-writer lock. Readers share the lock, writers own it
+ * exclusively and are preferred over new readers
+ *
+ * @return rwlock_t
+ */
+rwlock_t rwlock_init(void);
+
+/**
+ * @brief Wait to acquire the lock for reading. New readers wait while a
+ * writer is waiting
+ *
+ * @param rwlock Reader-writer lock
+ * @param timeout Time of block or MAX_DELAY for suspending
+ * @return true
+ * @return false
+ */
+bool rwlock_read_lock(rwlock_t rwlock, uint16_t timeout);
+
+/**
+ * @brief Release the lock acquired for reading
+ *
+ * @param rwlock Reader-writer lock
+ */
+void rwlock_read_unlock(rwlock_t rwlock);
+
+/**
+ * @brief Wait to acquire the lock for writing
+ *
+ * @param rwlock Reader-writer lock
+ * @param timeout Time of block or MAX_DELAY for suspending
+ * @return true
+ * @return false
+ */
+bool rwlock_write_lock(rwlock_t rwlock, uint16_t timeout);
+
+/**
+ * @brief Release the lock acquired for writing
+ *
+ * @param rwlock Reader-writer lock
+ */
+void rwlock_write_unlock(rwlock_t rwlock);
+
+/**
+ * @brief Deallocate the resources of reader-writer lock
+ *
+ * @param rwlock Reader-writer lock
+ */
+void rwlock_destroy(rwlock_t rwlock);
+#endif
+
+#if AVRTOS_USE_COND
+typedef struct cond *cond_t;
+
+/**
+ * @brief Create a condition variable
+ *
+ * @return cond_t
+ */
+cond_t cond_init(void);
+
+/**
+ * @brief Release the lock and wait for a signal in one step, then acquire the
+ * lock again. The lock is held on return even if the wait timed out
+ *
+ * @param cond Condition variable
+ * @param lock Semaphore used as mutex, held by the caller
+ * @param timeout Time of block or MAX_DELAY for suspending
+ * @return true Signalled
+ * @return false Timed out
+ */
+bool cond_wait(cond_t cond, semaphore_t lock, uint16_t timeout);
+
+/**
+ * @brief Wake the highest priority waiting task
+ *
+ * @param cond Condition variable
+ */
+void cond_signal(cond_t cond);
+
+/**
+ * @brief Wake all the waiting tasks, they run in priority order
+ *
+ * @param cond Condition variable
+ */
+void cond_broadcast(cond_t cond);
+
+/**
+ * @brief Deallocate the resources of condition variable
+ *
+ * @param cond Condition variable
+ */
+void cond_destroy(cond_t cond);
+#endif
+
+#if AVRTOS_USE_WORK
+/**
+ * @brief Statistics of the work queue
+ *
+ */
+typedef struct work_stats {
+  uint8_t depth;      ///< Number of items waiting in queue
+  uint8_t high_water; ///< Highest depth since start
+  uint16_t drops;     ///< Number of items dropped because queue was full
+} work_stats_t;
+
+/**
+ * @brief Create the worker task which runs the submitted work items in order
+ *
+ * @param priority Priority of the worker task, usually the highest one
+ * @param stack_size Size of the worker tasks stack
+ * @return true
+ * @return false if the worker already exists or out of memory
+ */
+bool work_init(uint8_t priority, size_t stack_size);
+
+/**
+ * @brief Queue a function to run in the worker task with interrupts enabled.
+ * Can be called from ISRs
+ *
+ * @param fn Function to run
+ * @param arg Argument passed to function
+ * @return true
+ * @return false Queue is full, the item is dropped
+ */
+bool work_submit(void (*fn)(void *), void *arg);
+
+/**
+ * @brief Get the statistics of the work queue
+ *
+ * @param stats Statistics to fill
+ */
+void work_stats(work_stats_t *stats);
+#endif
+
+#if AVRTOS_USE_CORO
+typedef struct coro *coro_t;
+
+/**
+ * @brief Result of one step of a coroutine
+ *
+ */
+typedef enum {
+  CORO_WAITING, ///< Coroutine waits for a delay, semaphore or queue
+  CORO_READY,   ///< Coroutine yielded and can run again
+  CORO_ENDED,   ///< Coroutine finished, its handle is freed
+} coro_status;
+
+/**
+ * @brief Create a stackless coroutine. All coroutines are run by one task on
+ * a stack of AVRTOS_CORO_STACK_SIZE bytes, with the priority of the highest
+ * priority ready coroutine. A coroutine function is written between
+ * CORO_BEGIN and CORO_END and is called again from where it stopped after
+ * every wait
+ *
+ * @warning Local variables do not keep their values across CORO_* waits, keep
+ * the state in arg or in static variables
+ *
+ * @param fn Function of coroutine
+ * @param arg Argument passed to function
+ * @param priority Priority of coroutine
+ * @return coro_t
+ */
+coro_t coro_init(coro_status (*fn)(coro_t coro, void *arg), void *arg,
+                 uint8_t priority);
+
+/**
+ * @brief Line the coroutine continues from, used by CORO_* macros
+ *
+ * @param coro Coroutine
+ * @return uint16_t*
+ */
+uint16_t *coro_lc(coro_t coro);
+
+/**
+ * @brief Make the coroutine wait for specified milliseconds after it returns
+ * CORO_WAITING, used by CORO_DELAY
+ *
+ * @param coro Coroutine
+ * @param ms Milliseconds to delay
+ */
+void coro_delay(coro_t coro, uint16_t ms);
+
+/**
+ * @brief Start the timeout of a wait, used by CORO_* macros
+ *
+ * @param coro Coroutine
+ * @param timeout Time of block or MAX_DELAY for suspending
+ */
+void coro_wait_start(coro_t coro, uint16_t timeout);
+
+#if AVRTOS_USE_SEMAPHORE
+/**
+ * @brief Try to acquire semaphore, used by CORO_SEMAPHORE_TAKE
+ *
+ * @param coro Coroutine
+ * @param sem Semaphore
+ * @return int8_t 1 if acquired, 0 if timed out, -1 if coroutine must return
+ * CORO_WAITING
+ */
+int8_t coro_semaphore_take(coro_t coro, semaphore_t sem);
+#endif
+
+#if AVRTOS_USE_QUEUE
+/**
+ * @brief Try to send to back of queue, used by CORO_QUEUE_SEND
+ *
+ * @param coro Coroutine
+ * @param queue Message queue
+ * @param item Message
+ * @return int8_t 1 if sent, 0 if timed out, -1 if coroutine must return
+ * CORO_WAITING
+ */
+int8_t coro_queue_send(coro_t coro, queue_t queue, const void *item);
+
+/**
+ * @brief Try to receive from front of queue, used by CORO_QUEUE_RECEIVE
+ *
+ * @param coro Coroutine
+ * @param queue Message queue
+ * @param item Message
+ * @return int8_t 1 if received, 0 if timed out, -1 if coroutine must return
+ * CORO_WAITING
+ */
+int8_t coro_queue_receive(coro_t coro, queue_t queue, void *item);
+#endif
+
+/**
+ * @brief Start of coroutine body
+ *
+ */
+#define CORO_BEGIN(coro)                                                       \
+  switch (*coro_lc(coro)) {                                                    \
+  case 0:
+
+/**
+ * @brief End of coroutine body, the coroutine is freed
+ *
+ */
+#define CORO_END(coro)                                                         \
+  }                                                                            \
+  return CORO_ENDED
+
+/**
+ * @brief Let other coroutines run and continue after this point
+ *
+ * @warning At most one CORO_* wait can be written on a line
+ */
+#define CORO_YIELD(coro)                                                       \
+  do {                                                                         \
+    *coro_lc(coro) = __LINE__;                                                 \
+    return CORO_READY;                                                         \
+  case __LINE__:;                                                              \
+  } while (0)
+
+/**
+ * @brief Wait for specified milliseconds
+ *
+ */
+#define CORO_DELAY(coro, ms)                                                   \
+  do {                                                                         \
+    coro_delay(coro, ms);                                                      \
+    *coro_lc(coro) = __LINE__;                                                 \
+    return CORO_WAITING;                                                       \
+  case __LINE__:;                                                              \
+  } while (0)
+
+/**
+ * @brief Run a coro_* try function until it succeeds or times out
+ *
+ */
+#define CORO_WAIT_UNTIL(coro, timeout, ok, attempt)                            \
+  do {                                                                         \
+    coro_wait_start(coro, timeout);                                            \
+    *coro_lc(coro) = __LINE__;                                                 \
+    __attribute__((fallthrough));                                              \
+  case __LINE__: {                                                             \
+    int8_t coro_result = (attempt);                                            \
+    if (coro_result < 0) {                                                     \
+      return CORO_WAITING;                                                     \
+    }                                                                          \
+    (ok) = coro_result;                                                        \
+  }                                                                            \
+  } while (0)
+
+#if AVRTOS_USE_SEMAPHORE
+/**
+ * @brief Wait to acquire semaphore, ok is set to false on timeout
+ *
+ */
+#define CORO_SEMAPHORE_TAKE(coro, sem, timeout, ok)                            \
+  CORO_WAIT_UNTIL(coro, timeout, ok, coro_semaphore_take(coro, sem))
+#endif
+
+#if AVRTOS_USE_QUEUE
+/**
+ * @brief Wait to send to back of queue, ok is set to false on timeout
+ *
+ */
+#define CORO_QUEUE_SEND(coro, queue, item, timeout, ok)                        \
+  CORO_WAIT_UNTIL(coro, timeout, ok, coro_queue_send(coro, queue, item))
+
+/**
+ * @brief Wait to receive from front of queue, ok is set to false on timeout
+ *
+ */
+#define CORO_QUEUE_RECEIVE(coro, queue, item, timeout, ok)                     \
+  CORO_WAIT_UNTIL(coro, timeout, ok, coro_queue_receive(coro, queue, item))
+#endif
+#endif
+
+/**
+ * @brief Start scheduler
+ *
+ * @warning If initialization is successful this function does not return
+ */
+void scheduler_init(void);
+
+/**
+ * @brief Stop switching tasks until the matching scheduler_unlock. Interrupts
+ * stay enabled and the tick keeps time and wakes tasks. Calls nest
+ *
+ * @warning The task must not delay or wait while the scheduler is locked
+ */
+void scheduler_lock(void);
+
+/**
+ * @brief Undo one scheduler_lock. The last unlock does the switch a tick
+ * postponed, if a higher or equal priority task is ready
+ *
+ */
+void scheduler_unlock(void);
+
+/**
+ * @brief Most bytes of the system stack used since the start of scheduler
+ *
+ * @return uint16_t
+ */
+uint16_t system_stack_high_water(void);
+
+#if AVRTOS_USE_TT
+/**
+ * @brief Slot of a time-triggered schedule table
+ *
+ */
+typedef struct tt_slot {
+  uint8_t frame;    ///< Minor frame the slot runs in, from 0
+  void (*fn)(void); ///< Function of the slot, must not delay or wait
+} tt_slot_t;
+
+/**
+ * @brief Start the time-triggered schedule. Every tick is a minor frame and
+ * runs the slots of the table with that frame, before any other task. Tasks
+ * run by priority in the time the slots leave
+ *
+ * @warning Slot functions must not delay, wait, end or destroy tasks.
+ * task_suspend(NULL) and task_set_priority(NULL, ...) do nothing in a slot or
+ * an ISR interrupting one
+ *
+ * @param table Slots in flash, declared with PROGMEM
+ * @param slot_count Number of slots in the table
+ * @param frames Minor frames in the major cycle
+ * @param stack_size Size of the stack the slots run on
+ * @return true if the schedule was started, false if one already runs or out
+ * of memory
+ */
+bool tt_init(const tt_slot_t *table, uint8_t slot_count, uint8_t frames,
+             size_t stack_size);
+
+/**
+ * @brief Number of minor frames skipped because the previous frame overran
+ *
+ * @return uint16_t
+ */
+uint16_t tt_overruns(void);
+#endif
+
+#if AVRTOS_USE_STATS
+/**
+ * @brief Scheduler statistics
+ *
+ */
+typedef struct scheduler_stats {
+  tick_t ticks;              ///< Ticks since the start of scheduler
+  tick_t idle_ticks;         ///< Ticks the idle task was running on
+  uint16_t context_switches; ///< Number of context switches
+} scheduler_stats_t;
+
+/**
+ * @brief Get the scheduler statistics
+ *
+ * @param stats Statistics to fill
+ */
+void scheduler_stats(scheduler_stats_t *stats);
+#endif
+
+#if AVRTOS_USE_TRACE
+/**
+ * @brief Events of trace records
+ *
+ */
+typedef enum {
+  TRACE_TICK,          ///< First record of a tick, object is the tick
+  TRACE_TASK_CREATE,   ///< Task is created, object is its priority
+  TRACE_SWITCH,        ///< Task starts running, object is the previous task
+  TRACE_BLOCK,         ///< Task blocks, object is the channel
+  TRACE_SUSPEND,       ///< Task suspends, object is the channel
+  TRACE_WAKE,          ///< Task is woken, object is the channel
+  TRACE_SEM_TAKE,      ///< Semaphore is taken, object is the semaphore
+  TRACE_SEM_GIVE,      ///< Semaphore is given, object is the semaphore
+  TRACE_QUEUE_SEND,    ///< Item is sent to queue, object is the queue
+  TRACE_QUEUE_RECEIVE, ///< Item is received from queue, object is the queue
+  TRACE_USER,          ///< Recorded by trace_user
+} trace_event;
+
+/**
+ * @brief Trace record as stored and sent after a 0xa5 sync byte, in little
+ * endian
+ *
+ */
+typedef struct trace_record {
+  uint8_t event;   ///< trace_event
+  uint8_t task;    ///< Id of the task, or of the event for TRACE_USER
+  uint16_t time;   ///< Timer 1 count within the tick (0.5us at 16 MHz)
+  uint16_t object; ///< Low 16 bits of the event object
+} trace_record_t;
+
+/**
+ * @brief Trace modes
+ *
+ */
+typedef enum {
+  TRACE_SNAPSHOT, ///< Keep the latest records until trace_dump
+  TRACE_STREAM,   ///< Send records over UART from its interrupt
+} trace_mode;
+
+/**
+ * @brief Start recording. In stream mode the UART must not be used by print
+ *
+ * @param mode Trace mode
+ */
+void trace_start(trace_mode mode);
+
+/**
+ * @brief Stop recording
+ *
+ */
+void trace_stop(void);
+
+/**
+ * @brief Stop recording and send the recorded records over UART
+ *
+ */
+void trace_dump(void);
+
+/**
+ * @brief Record an event of the application, e.g. an ISR firing. Can be called
+ * from ISRs
+ *
+ * @param id Id of the event
+ * @param value Value of the event
+ */
+void trace_user(uint8_t id, uint16_t value);
+
+/**
+ * @brief Number of records dropped because the stream could not keep up
+ *
+ * @return uint16_t
+ */
+uint16_t trace_drops(void);
+#endif
+
+#if AVRTOS_USE_UART
+/**
+ * @brief Initialize the UART driver
+ *
+ */
+void uart_init(void);
+
+/**
+ * @brief Print to standard output
+ *
+ * @param fmt Format string
+ * @param ... Arguments
+ * @return int
+ */
+int print(const char *fmt, ...);
+#endif
+
+#if AVRTOS_USE_GPIO
+/**
+ * @brief Set pin mode
+ *
+ * @param pin
+ * @param mode
+ */
+void gpio_set_pin_mode(uint8_t pin, gpio_pin_mode mode);
+
+/**
+ * @brief Write low or high to a pin
+ *
+ * @param pin
+ * @param value
+ */
+void gpio_pin_write(uint8_t pin, uint8_t value);
+
+/**
+ * @brief Read the pin
+ *
+ * @param pin
+ * @return uint8_t HIGH or LOW
+ */
+uint8_t gpio_pin_read(uint8_t pin);
+
+/**
+ * @brief Write low or high to a pin. When pin and value are constants this
+ * compiles to a single sbi or cbi instruction
+ *
+ * @param pin
+ * @param value
+ */
+static inline __attribute__((always_inline)) void
+gpio_pin_write_fast(uint8_t pin, uint8_t value) {
+  if (pin < 8) {
+    if (value) {
+      PORTD |= _BV(pin);
+    } else {
+      PORTD &= ~_BV(pin);
+    }
+  } else if (pin < 14) {
+    if (value) {
+      PORTB |= _BV(pin - 8);
+    } else {
+      PORTB &= ~_BV(pin - 8);
+    }
+  } else if (pin <= A5) {
+    if (value) {
+      PORTC |= _BV(pin - 14);
+    } else {
+      PORTC &= ~_BV(pin - 14);
+    }
+  }
+}
+
+/**
+ * @brief Toggle a pin by writing its bit to PINx. When pin is a constant this
+ * compiles to an ldi and an out instruction
+ *
+ * @param pin
+ */
+static inline __attribute__((always_inline)) void
+gpio_pin_toggle_fast(uint8_t pin) {
+  if (pin < 8) {
+    PIND = _BV(pin);
+  } else if (pin < 14) {
+    PINB = _BV(pin - 8);
+  } else if (pin <= A5) {
+    PINC = _BV(pin - 14);
+  }
+}
+
+/**
+ * @brief Read the pin. When pin is a constant and the result is tested this
+ * compiles to a single sbic or sbis instruction
+ *
+ * @param pin
+ * @return uint8_t HIGH or LOW
+ */
+static inline __attribute__((always_inline)) uint8_t
+gpio_pin_read_fast(uint8_t pin) {
+  if (pin < 8) {
+    return (PIND & _BV(pin)) ? HIGH : LOW;
+  } else if (pin < 14) {
+    return (PINB & _BV(pin - 8)) ? HIGH : LOW;
+  } else if (pin <= A5) {
+    return (PINC & _BV(pin - 14)) ? HIGH : LOW;
+  }
+  return LOW;
+}
+
+/**
+ * @brief Write the masked pins of a port at once
+ *
+ * @param port
+ * @param mask Pins of port to write
+ * @param value
+ */
+static inline __attribute__((always_inline)) void
+gpio_port_write(gpio_port port, uint8_t mask, uint8_t value) {
+  volatile uint8_t *reg = (port == GPIO_PORTB)   ? &PORTB
+                          : (port == GPIO_PORTC) ? &PORTC
+                                                 : &PORTD;
+  if (mask == 0xff) {
+    *reg = value;
+  } else {
+    uint8_t sreg = critical_enter();
+    *reg = (*reg & ~mask) | (value & mask);
+    critical_exit(sreg);
+  }
+}
+
+/**
+ * @brief Read all pins of a port at once
+ *
+ * @param port
+ * @return uint8_t
+ */
+static inline __attribute__((always_inline)) uint8_t
+gpio_port_read(gpio_port port) {
+  return (port == GPIO_PORTB)   ? PINB
+         : (port == GPIO_PORTC) ? PINC
+                                : PIND;
+}
+#endif
+
+#if AVRTOS_USE_ADC
+/**
+ * @brief ADC voltage references
+ *
+ */
+typedef enum {
+  ADC_REF_AREF,     ///< External voltage on AREF pin
+  ADC_REF_AVCC,     ///< AVcc
+  ADC_REF_INTERNAL, ///< Internal 1.1V reference
+} adc_reference;
+
+/**
+ * @brief Trigger sources of ADC scans
+ *
+ */
+typedef enum {
+  ADC_TRIGGER_FREE_RUNNING, ///< Start next conversion when one completes
+  ADC_TRIGGER_TIMER0_COMPA, ///< Timer 0 compare match A (configured by user)
+  ADC_TRIGGER_TIMER1_COMPB, ///< Timer 1 compare match B, once every tick
+} adc_trigger;
+
+/**
+ * @brief Initialize the ADC driver
+ *
+ * @param reference Voltage reference of conversions
+ */
+void adc_init(adc_reference reference);
+
+/**
+ * @brief Convert an analog pin once. The task blocks until the conversion
+ * completes
+ *
+ * @param pin One of A0 - A5
+ * @param value Result of conversion
+ * @param timeout Time of block or MAX_DELAY for suspending
+ * @return true
+ * @return false if timeout occurred, the pin is invalid or a scan is running
+ */
+bool adc_read(uint8_t pin, uint16_t *value, uint16_t timeout);
+
+/**
+ * @brief Start converting the pins in turn into a ring buffer of blocks.
+ * Single conversions fail until the scan is stopped
+ *
+ * @param pins Pins to scan, A0 - A5
+ * @param pin_count Number of pins
+ * @param trigger Trigger source of conversions
+ * @param block_size Number of samples in a block
+ * @param block_count Number of blocks in ring buffer, at least 2
+ * @return true
+ * @return false
+ */
+bool adc_scan_start(const uint8_t *pins, uint8_t pin_count, adc_trigger trigger,
+                    uint8_t block_size, uint8_t block_count);
+
+/**
+ * @brief Copy the oldest filled block of the scan
+ *
+ * @param block Buffer of block_size samples
+ * @param timeout Time of block or MAX_DELAY for suspending
+ * @return true
+ * @return false
+ */
+bool adc_scan_read(uint16_t *block, uint16_t timeout);
+
+/**
+ * @brief Number of blocks overwritten before they were read
+ *
+ * @return uint8_t
+ */
+uint8_t adc_scan_overruns(void);
+
+/**
+ * @brief Stop the scan and deallocate its buffer
+ *
+ */
+void adc_scan_stop(void);
+#endif
+
+#if AVRTOS_USE_SPI
+/**
+ * @brief SPI clock polarity and phase
+ *
+ */
+typedef enum {
+  SPI_MODE0, ///< Idle low, sample on rising edge
+  SPI_MODE1, ///< Idle low, sample on falling edge
+  SPI_MODE2, ///< Idle high, sample on falling edge
+  SPI_MODE3, ///< Idle high, sample on rising edge
+} spi_mode;
+
+/**
+ * @brief SPI clock divider
+ *
+ */
+typedef enum {
+  SPI_CLOCK_DIV2,
+  SPI_CLOCK_DIV4,
+  SPI_CLOCK_DIV8,
+  SPI_CLOCK_DIV16,
+  SPI_CLOCK_DIV32,
+  SPI_CLOCK_DIV64,
+  SPI_CLOCK_DIV128,
+} spi_clock;
+
+/**
+ * @brief Initialize the SPI driver as master
+ *
+ * @param mode Clock polarity and phase
+ * @param clock Clock divider
+ */
+void spi_init(spi_mode mode, spi_clock clock);
+
+/**
+ * @brief Queue a transfer and block until it completes. Bytes are clocked out
+ * from the SPI interrupt, so other tasks run during the transfer
+ *
+ * @param cs_pin Chip select pin, driven low during the transfer
+ * @param tx Bytes to send, 0xff is sent if NULL
+ * @param rx Buffer for received bytes, discarded if NULL
+ * @param length Number of bytes
+ * @param timeout Time of block or MAX_DELAY for suspending
+ * @return true
+ * @return false
+ */
+bool spi_transfer(uint8_t cs_pin, const void *tx, void *rx, uint16_t length,
+                  uint16_t timeout);
+#endif
+
+#if AVRTOS_USE_TWI
+/**
+ * @brief Result of TWI transfers
+ *
+ */
+typedef enum {
+  TWI_OK,               ///< Transfer is completed
+  TWI_ADDRESS_NACK,     ///< Slave did not acknowledge its address
+  TWI_DATA_NACK,        ///< Slave did not acknowledge a data byte
+  TWI_ARBITRATION_LOST, ///< Another master took the bus
+  TWI_BUS_ERROR,        ///< Illegal start or stop condition on bus
+  TWI_TIMEOUT,          ///< Bus or transfer did not complete in time
+} twi_status;
+
+/**
+ * @brief Initialize the TWI (I2C) driver as master
+ *
+ * @param frequency SCL frequency in Hz, 100000 or 400000
+ */
+void twi_init(uint32_t frequency);
+
+/**
+ * @brief Write bytes to a slave. The task blocks until the transfer completes
+ *
+ * @param address 7-bit slave address
+ * @param data Bytes to write
+ * @param length Number of bytes
+ * @param timeout Time of block or MAX_DELAY for suspending
+ * @return twi_status
+ */
+twi_status twi_write(uint8_t address, const void *data, uint8_t length,
+                     uint16_t timeout);
+
+/**
+ * @brief Read bytes from a slave. The task blocks until the transfer completes
+ *
+ * @param address 7-bit slave address
+ * @param data Buffer for read bytes
+ * @param length Number of bytes
+ * @param timeout Time of block or MAX_DELAY for suspending
+ * @return twi_status
+ */
+twi_status twi_read(uint8_t address, void *data, uint8_t length,
+                    uint16_t timeout);
+
+/**
+ * @brief Write bytes then read bytes from a slave with a repeated start. The
+ * task blocks until the transfer completes
+ *
+ * @param address 7-bit slave address
+ * @param tx Bytes to write
+ * @param tx_length Number of bytes to write
+ * @param rx Buffer for read bytes
+ * @param rx_length Number of bytes to read
+ * @param timeout Time of block or MAX_DELAY for suspending
+ * @return twi_status
+ */
+twi_status twi_write_read(uint8_t address, const void *tx, uint8_t tx_length,
+                          void *rx, uint8_t rx_length, uint16_t timeout);
+#endif
+
+#if AVRTOS_USE_PWM
+/**
+ * @brief Timers free for PWM, timer 1 is used by the kernel tick
+ *
+ */
+typedef enum {
+  PWM_TIMER0, ///< Pins 6 (A) and 5 (B)
+  PWM_TIMER2, ///< Pins 11 (A) and 3 (B)
+} pwm_timer;
+
+/**
+ * @brief Clock prescalers of PWM timers
+ *
+ */
+typedef enum {
+  PWM_PRESCALER_1,
+  PWM_PRESCALER_8,
+  PWM_PRESCALER_32, ///< Timer 2 only
+  PWM_PRESCALER_64,
+  PWM_PRESCALER_128, ///< Timer 2 only
+  PWM_PRESCALER_256,
+  PWM_PRESCALER_1024,
+} pwm_prescaler;
+
+/**
+ * @brief Configure a timer for fast PWM. The frequency is
+ * F_CPU / (prescaler * (top + 1)) and duty cycles range from 0 to top. With a
+ * top other than 0xff the A pin of the timer is not available. Enabled pins
+ * stay connected when a timer is configured again
+ *
+ * @param timer Timer
+ * @param prescaler Clock prescaler
+ * @param top Resolution of duty cycle
+ * @return true
+ * @return false if timer or prescaler is invalid for the timer
+ */
+bool pwm_init(pwm_timer timer, pwm_prescaler prescaler, uint8_t top);
+
+/**
+ * @brief Connect a pin to its PWM output
+ *
+ * @param pin One of 3, 5, 6, 11
+ * @return true
+ * @return false
+ */
+bool pwm_enable(uint8_t pin);
+
+/**
+ * @brief Set the duty cycle of a pin. The new value takes effect at the start
+ * of the next period, so updates never glitch. Can be called from ISRs
+ *
+ * @warning Fast PWM still gives a one timer clock pulse every period at a
+ * duty of 0, use pwm_disable for a steady low
+ *
+ * @param pin One of 3, 5, 6, 11
+ * @param duty Duty cycle from 0 to top
+ */
+void pwm_write(uint8_t pin, uint8_t duty);
+
+/**
+ * @brief Disconnect a pin from its PWM output and drive it low
+ *
+ * @param pin One of 3, 5, 6, 11
+ */
+void pwm_disable(uint8_t pin);
+#endif
+
+#if AVRTOS_USE_GPIO_IRQ
+/**
+ * @brief Edges that trigger GPIO interrupts
+ *
+ */
+typedef enum {
+  GPIO_EDGE_RISING,
+  GPIO_EDGE_FALLING,
+  GPIO_EDGE_ANY,
+} gpio_edge;
+
+/**
+ * @brief Edge detected on a pin
+ *
+ */
+typedef struct gpio_event {
+  uint8_t pin;   ///< Pin of the edge
+  uint8_t value; ///< Level of pin after the edge
+  tick_t tick;   ///< Tick of the edge
+  uint16_t time; ///< Timer 1 count within the tick (0.5us at 16 MHz)
+} gpio_event_t;
+
+/**
+ * @brief Deliver the edges of a pin to waiting tasks and a callback. Pins 2
+ * and 3 use INT0 and INT1, the other pins use pin change interrupts
+ *
+ * @param pin Pin to watch, 0 - 13 or A0 - A5
+ * @param edge Edges to deliver
+ * @param debounce Milliseconds to ignore edges after a delivered one
+ * @param callback Called from the ISR for every delivered edge, can be NULL
+ * @return true
+ * @return false
+ */
+bool gpio_irq_attach(uint8_t pin, gpio_edge edge, uint16_t debounce,
+                     void (*callback)(const gpio_event_t *));
+
+/**
+ * @brief Wait for the next edge of a pin. An edge delivered while no task was
+ * waiting is kept until it is read
+ *
+ * @param pin Attached pin
+ * @param event Delivered edge
+ * @param timeout Time of block or MAX_DELAY for suspending
+ * @return true
+ * @return false
+ */
+bool gpio_irq_wait(uint8_t pin, gpio_event_t *event, uint16_t timeout);
+
+/**
+ * @brief Stop delivering the edges of a pin
+ *
+ * @param pin Attached pin
+ */
+void gpio_irq_detach(uint8_t pin);
+#endif
+
+#if AVRTOS_USE_EEPROM
+/**
+ * @brief Queue bytes to be written to EEPROM in the background. Bytes equal
+ * to the EEPROM content are skipped and queued writes to the same address are
+ * merged
+ *
+ * @warning On timeout the bytes queued before it are still written, the
+ * EEPROM may hold a part of data
+ *
+ * @param address EEPROM address
+ * @param data Bytes to write
+ * @param length Number of bytes
+ * @param timeout Time of block or MAX_DELAY for suspending while queue is full
+ * @return true
+ * @return false if timeout occurred
+ */
+bool eeprom_write(uint16_t address, const void *data, uint16_t length,
+                  uint16_t timeout);
+
+/**
+ * @brief Read bytes from EEPROM, including the queued writes
+ *
+ * @param address EEPROM address
+ * @param data Buffer for read bytes
+ * @param length Number of bytes
+ */
+void eeprom_read(uint16_t address, void *data, uint16_t length);
+
+/**
+ * @brief Wait until all queued writes are done
+ *
+ * @param timeout Time of block or MAX_DELAY for suspending
+ * @return true
+ * @return false
+ */
+bool eeprom_flush(uint16_t timeout);
+#endif
 
 #endif
@@ -0,0 +1,226 @@
+#ifndef AVRTOS_CONFIG_H
+#define AVRTOS_CONFIG_H
+
+/*
+ * Compile-time configuration of AVRtos. Every option can be overridden from
+ * the command line, e.g. make CONFIG="-DAVRTOS_USE_ADC=0". Disabled features
+ * are removed from both the header and the kernel.
+ */
+
+#if defined(__AVR_ATmega328P__)
+#define AVRTOS_UNO_PINS 1 ///< Drivers with fixed pins use the Uno pin layout
+#else
+#define AVRTOS_UNO_PINS 0 ///< Drivers with fixed pins are not ported
+#endif
+
+#ifndef AVRTOS_TASK_NAME_LENGTH
+/**
+ * @brief Maximum length of task names, 0 removes names from tasks
+ *
+ */
+#define AVRTOS_TASK_NAME_LENGTH 15
+#endif
+
+#ifndef AVRTOS_TICK_WIDTH
+/**
+ * @brief Width of tick counter in bits, 16 or 32. A 16 bit counter wraps
+ * after 10.9 minutes
+ *
+ */
+#define AVRTOS_TICK_WIDTH 16
+#endif
+
+#ifndef AVRTOS_SCHED_EDF
+/**
+ * @brief Order ready tasks with deadlines by earliest deadline first. Tasks
+ * without a deadline run by priority when no task with a deadline is ready
+ *
+ */
+#define AVRTOS_SCHED_EDF 0
+#endif
+
+#ifndef AVRTOS_COOPERATIVE
+/**
+ * @brief Switch tasks only when the running task delays, waits or calls
+ * task_yield. The tick keeps time and wakes tasks but never preempts, and a
+ * switch saves only the call-saved registers
+ *
+ */
+#define AVRTOS_COOPERATIVE 0
+#endif
+
+#ifndef AVRTOS_USE_TT
+/**
+ * @brief Time-triggered schedule. A table in flash runs functions in fixed
+ * ticks of a repeating cycle, ahead of the priority tasks
+ *
+ */
+#define AVRTOS_USE_TT 0
+#endif
+
+#ifndef AVRTOS_SYSTEM_STACK_SIZE
+/**
+ * @brief Size of the stack the tick, context switches and driver ISRs run on.
+ * Task stacks only hold their own frames and one saved context
+ *
+ */
+#define AVRTOS_SYSTEM_STACK_SIZE 192
+#endif
+
+#ifndef AVRTOS_USE_CORO
+#define AVRTOS_USE_CORO 1 ///< Stackless coroutines sharing one stack
+#endif
+
+#ifndef AVRTOS_CORO_STACK_SIZE
+#define AVRTOS_CORO_STACK_SIZE 192 ///< Size of the stack shared by coroutines
+#endif
+
+#ifndef AVRTOS_USE_SEMAPHORE
+#define AVRTOS_USE_SEMAPHORE 1 ///< Semaphores
+#endif
+
+#ifndef AVRTOS_USE_QUEUE
+#define AVRTOS_USE_QUEUE 1 ///< FIFO queues
+#endif
+
+#ifndef AVRTOS_USE_MAILBOX
+#define AVRTOS_USE_MAILBOX 1 ///< Latest-value mailboxes
+#endif
+
+#ifndef AVRTOS_USE_TOPIC
+#define AVRTOS_USE_TOPIC 1 ///< Publish/subscribe topics
+#endif
+
+#ifndef AVRTOS_USE_RWLOCK
+#define AVRTOS_USE_RWLOCK 1 ///< Reader-writer locks
+#endif
+
+#ifndef AVRTOS_USE_COND
+#define AVRTOS_USE_COND 1 ///< Condition variables
+#endif
+
+#ifndef AVRTOS_USE_WORK
+#define AVRTOS_USE_WORK 1 ///< Work queue for deferring ISR work to a task
+#endif
+
+#ifndef AVRTOS_WORK_QUEUE_SIZE
+#define AVRTOS_WORK_QUEUE_SIZE 16 ///< Number of work items, a power of two
+#endif
+
+#ifndef AVRTOS_USE_UART
+#define AVRTOS_USE_UART 1 ///< UART driver, stdio streams and print
+#endif
+
+#ifndef AVRTOS_USE_GPIO
+#define AVRTOS_USE_GPIO AVRTOS_UNO_PINS ///< GPIO driver
+#endif
+
+#ifndef AVRTOS_USE_GPIO_IRQ
+#define AVRTOS_USE_GPIO_IRQ AVRTOS_UNO_PINS ///< INT and pin change driver
+#endif
+
+#ifndef AVRTOS_USE_ADC
+#define AVRTOS_USE_ADC 1 ///< ADC driver
+#endif
+
+#ifndef AVRTOS_USE_SPI
+#define AVRTOS_USE_SPI AVRTOS_UNO_PINS ///< SPI master driver
+#endif
+
+#ifndef AVRTOS_USE_TWI
+#define AVRTOS_USE_TWI AVRTOS_UNO_PINS ///< TWI (I2C) master driver
+#endif
+
+#ifndef AVRTOS_USE_PWM
+#define AVRTOS_USE_PWM AVRTOS_UNO_PINS ///< PWM driver
+#endif
+
+#ifndef AVRTOS_USE_EEPROM
+#define AVRTOS_USE_EEPROM 1 ///< EEPROM driver
+#endif
+
+#ifndef AVRTOS_EEPROM_QUEUE_SIZE
+#define AVRTOS_EEPROM_QUEUE_SIZE 16 ///< Number of bytes waiting to be written
+#endif
+
+#ifndef AVRTOS_USE_TIME
+#define AVRTOS_USE_TIME 1 ///< Advance the time.h system clock every second
+#endif
+
+#ifndef AVRTOS_USE_STATS
+#define AVRTOS_USE_STATS 1 ///< Scheduler statistics
+#endif
+
+#ifndef AVRTOS_USE_TRACE
+/**
+ * @brief Record scheduler and primitive events into a ring buffer which can
+ * be dumped or streamed over UART
+ *
+ */
+#define AVRTOS_USE_TRACE 0
+#endif
+
+#ifndef AVRTOS_TRACE_BUFFER_SIZE
+#define AVRTOS_TRACE_BUFFER_SIZE 32 ///< Number of records, a power of two
+#endif
+
+#ifndef AVRTOS_PROFILE_CRITICAL
+/**
+ * @brief Record the longest span interrupts are disabled by critical sections
+ *
+ */
+#define AVRTOS_PROFILE_CRITICAL 0
+#endif
+
+#if AVRTOS_TICK_WIDTH != 16 && AVRTOS_TICK_WIDTH != 32
+#error "AVRTOS_TICK_WIDTH must be 16 or 32"
+#endif
+
+#if AVRTOS_WORK_QUEUE_SIZE & (AVRTOS_WORK_QUEUE_SIZE - 1) ||                  \
+    AVRTOS_WORK_QUEUE_SIZE > 128
+#error "AVRTOS_WORK_QUEUE_SIZE must be a power of two up to 128"
+#endif
+
+#if AVRTOS_USE_TT && AVRTOS_COOPERATIVE
+#error "AVRTOS_USE_TT requires a preemptive scheduler"
+#endif
+
+#if AVRTOS_USE_COND && !AVRTOS_USE_SEMAPHORE
+#error "AVRTOS_USE_COND requires AVRTOS_USE_SEMAPHORE"
+#endif
+
+#if !AVRTOS_UNO_PINS && (AVRTOS_USE_GPIO || AVRTOS_USE_GPIO_IRQ ||             \
+                          AVRTOS_USE_SPI || AVRTOS_USE_TWI || AVRTOS_USE_PWM)
+#error "GPIO, GPIO interrupt, SPI, TWI and PWM drivers support only ATmega328p"
+#endif
+
+#if AVRTOS_TRACE_BUFFER_SIZE & (AVRTOS_TRACE_BUFFER_SIZE - 1) ||              \
+    AVRTOS_TRACE_BUFFER_SIZE > 128
+#error "AVRTOS_TRACE_BUFFER_SIZE must be a power of two up to 128"
+#endif
+
+#if AVRTOS_USE_TRACE && !AVRTOS_USE_UART
+#error "AVRTOS_USE_TRACE requires AVRTOS_USE_UART"
+#endif
+
+#if AVRTOS_USE_UART && !AVRTOS_USE_SEMAPHORE
+#error "AVRTOS_USE_UART requires AVRTOS_USE_SEMAPHORE"
+#endif
+
+#if AVRTOS_USE_ADC && !AVRTOS_USE_SEMAPHORE
+#error "AVRTOS_USE_ADC requires AVRTOS_USE_SEMAPHORE"
+#endif
+
+#if AVRTOS_USE_SPI && !AVRTOS_USE_GPIO
+#error "AVRTOS_USE_SPI requires AVRTOS_USE_GPIO"
+#endif
+
+#if AVRTOS_USE_TWI && (!AVRTOS_USE_GPIO || !AVRTOS_USE_SEMAPHORE)
+#error "AVRTOS_USE_TWI requires AVRTOS_USE_GPIO and AVRTOS_USE_SEMAPHORE"
+#endif
+
+#if AVRTOS_USE_PWM && !AVRTOS_USE_GPIO
+#error "AVRTOS_USE_PWM requires AVRTOS_USE_GPIO"
+#endif
+
+#endif
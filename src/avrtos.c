@@ -1,19 +1,145 @@
 #include "avrtos.h"
 
-#include <math.h>
-#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+
+#if AVRTOS_USE_UART
+#include <stdio.h>
+#endif
+
+#if AVRTOS_USE_TIME
 #include <time.h>
+#endif
 
 #include <avr/interrupt.h>
 #include <avr/io.h>
+
+#if AVRTOS_USE_UART
 #include <util/setbaud.h>
+#endif
+
+#if defined(__AVR_3_BYTE_PC__)
+/**
+ * @brief Save RAMPZ (0x3b) and EIND (0x3c) of devices with a 3-byte PC
+ *
+ */
+#define SAVE_EXTENDED_CONTEXT                                                  \
+  "in r0, 0x3b\n\t"                                                            \
+  "push r0\n\t"                                                                \
+  "in r0, 0x3c\n\t"                                                            \
+  "push r0\n\t"
+
+/**
+ * @brief Restore EIND and RAMPZ of devices with a 3-byte PC
+ *
+ */
+#define RESTORE_EXTENDED_CONTEXT                                               \
+  "pop r0\n\t"                                                                 \
+  "out 0x3c, r0\n\t"                                                           \
+  "pop r0\n\t"                                                                 \
+  "out 0x3b, r0\n\t"
+#else
+#define SAVE_EXTENDED_CONTEXT ""    ///< No extended registers to save
+#define RESTORE_EXTENDED_CONTEXT "" ///< No extended registers to restore
+#endif
+
+#if AVRTOS_TICK_WIDTH == 32
+typedef int32_t tick_diff_t; ///< Signed difference of ticks
+#else
+typedef int16_t tick_diff_t; ///< Signed difference of ticks
+#endif
+
+/**
+ * @brief Whether the tick count reached a tick, also across the wrap of the
+ * counter
+ *
+ */
+#define TICK_REACHED(tick) ((tick_diff_t)(global_tick_count - (tick)) >= 0)
+
+#define SYSTEM_STACK_PAINT 0xaa ///< Value of system stack bytes never used
+
+/**
+ * @brief Move the stack pointer to the top of the system stack. Used after
+ * the context of the interrupted task is saved
+ *
+ */
+#define ENTER_SYSTEM_STACK()                                                   \
+  asm volatile("ldi r28, lo8(system_stack+%0)\n\t"                             \
+               "ldi r29, hi8(system_stack+%0)\n\t"                             \
+               "out __SP_L__, r28\n\t"                                         \
+               "out __SP_H__, r29\n\t" ::"i"(AVRTOS_SYSTEM_STACK_SIZE - 1))
 
-#define TASK_NAME_LENGTH 15 ///< Maximum length of task name
+/**
+ * @brief Define a driver ISR which runs on the system stack. Only the return
+ * address and three registers are pushed to the interrupted tasks stack, the
+ * registers the handler may clobber are saved on the system stack. If the
+ * handler woke a task higher than the interrupted one, the ISR exits through
+ * task_switch to switch to it
+ *
+ */
+#define KERNEL_ISR(vector)                                                     \
+  static void vector##_handler(void) __attribute__((used));                    \
+  ISR(vector, ISR_NAKED) {                                                     \
+    asm volatile("push r28\n\t"                                                \
+                 "push r29\n\t"                                                \
+                 "push r27\n\t"                                                \
+                 "in r28, __SP_L__\n\t"                                        \
+                 "in r29, __SP_H__\n\t"                                        \
+                 "ldi r27, lo8(system_stack+%0)\n\t"                           \
+                 "out __SP_L__, r27\n\t"                                       \
+                 "ldi r27, hi8(system_stack+%0)\n\t"                           \
+                 "out __SP_H__, r27\n\t"                                       \
+                 "push r0\n\t"                                                 \
+                 "in r0, __SREG__\n\t"                                         \
+                 "push r0\n\t" SAVE_EXTENDED_CONTEXT "push r1\n\t"             \
+                 "clr r1\n\t"                                                  \
+                 "push r18\n\t"                                                \
+                 "push r19\n\t"                                                \
+                 "push r20\n\t"                                                \
+                 "push r21\n\t"                                                \
+                 "push r22\n\t"                                                \
+                 "push r23\n\t"                                                \
+                 "push r24\n\t"                                                \
+                 "push r25\n\t"                                                \
+                 "push r26\n\t"                                                \
+                 "push r30\n\t"                                                \
+                 "push r31\n\t"                                                \
+                 "call " #vector "_handler\n\t"                                \
+                 "pop r31\n\t"                                                 \
+                 "pop r30\n\t"                                                 \
+                 "pop r26\n\t"                                                 \
+                 "pop r25\n\t"                                                 \
+                 "pop r24\n\t"                                                 \
+                 "pop r23\n\t"                                                 \
+                 "pop r22\n\t"                                                 \
+                 "pop r21\n\t"                                                 \
+                 "pop r20\n\t"                                                 \
+                 "pop r19\n\t"                                                 \
+                 "pop r18\n\t"                                                 \
+                 "pop r1\n\t" RESTORE_EXTENDED_CONTEXT "pop r0\n\t"            \
+                 "out __SREG__, r0\n\t"                                        \
+                 "pop r0\n\t"                                                  \
+                 "out __SP_L__, r28\n\t"                                       \
+                 "out __SP_H__, r29\n\t"                                       \
+                 "lds r27, need_switch\n\t"                                    \
+                 "sbrc r27, 0\n\t"                                             \
+                 "rjmp 1f\n\t"                                                 \
+                 "pop r27\n\t"                                                 \
+                 "pop r29\n\t"                                                 \
+                 "pop r28\n\t"                                                 \
+                 "reti\n\t"                                                    \
+                 "1: pop r27\n\t"                                              \
+                 "pop r29\n\t"                                                 \
+                 "pop r28\n\t"                                                 \
+                 "jmp task_switch" ::"i"(AVRTOS_SYSTEM_STACK_SIZE - 1));       \
+  }                                                                            \
+  static void vector##_handler(void)
+
+#define ADC_PRESCALER (_BV(ADPS2) | _BV(ADPS1) | _BV(ADPS0)) ///< 125 kHz
 
-#define TASK_CONTEXT_SIZE 35 ///< Context size of a task
+#define ADC_MAX_PINS 6 ///< Number of analog pins
 
+#if !AVRTOS_COOPERATIVE
 /**
  * @brief Save context of a task in its stack
  *
@@ -22,7 +148,7 @@
   asm volatile("push r0\n\t"                                                   \
                "in r0, __SREG__\n\t"                                           \
                "cli\n\t"                                                       \
-               "push r0\n\t"                                                   \
+               "push r0\n\t" SAVE_EXTENDED_CONTEXT                             \
                "push r1\n\t"                                                   \
                "clr r1\n\t"                                                    \
                "push r2\n\t"                                                   \
@@ -103,23 +229,99 @@
                "pop r4\n\t"                                                    \
                "pop r3\n\t"                                                    \
                "pop r2\n\t"                                                    \
-               "pop r1\n\t"                                                    \
+               "pop r1\n\t" RESTORE_EXTENDED_CONTEXT                           \
                "pop r0\n\t"                                                    \
                "out __SREG__, r0\n\t"                                          \
                "pop r0");
+#else
+/**
+ * @brief Save the call-saved registers of a task in its stack. A cooperative
+ * task is only switched inside task_switch, which it calls like a function
+ *
+ */
+#define SAVE_CONTEXT()                                                         \
+  asm volatile("push r2\n\t"                                                   \
+               "push r3\n\t"                                                   \
+               "push r4\n\t"                                                   \
+               "push r5\n\t"                                                   \
+               "push r6\n\t"                                                   \
+               "push r7\n\t"                                                   \
+               "push r8\n\t"                                                   \
+               "push r9\n\t"                                                   \
+               "push r10\n\t"                                                  \
+               "push r11\n\t"                                                  \
+               "push r12\n\t"                                                  \
+               "push r13\n\t"                                                  \
+               "push r14\n\t"                                                  \
+               "push r15\n\t"                                                  \
+               "push r16\n\t"                                                  \
+               "push r17\n\t"                                                  \
+               "push r28\n\t"                                                  \
+               "push r29\n\t"                                                  \
+               "lds r26, current_task\n\t"                                     \
+               "lds r27, current_task+1\n\t"                                   \
+               "in r0, __SP_L__\n\t"                                           \
+               "st x+, r0\n\t"                                                 \
+               "in r0, __SP_H__\n\t"                                           \
+               "st x+, r0\n\t");
+
+/**
+ * @brief Restore the call-saved registers of a task from its stack
+ *
+ */
+#define RESTORE_CONTEXT()                                                      \
+  asm volatile("lds r26, current_task\n\t"                                     \
+               "lds r27, current_task+1\n\t"                                   \
+               "ld r28, x+\n\t"                                                \
+               "out __SP_L__, r28\n\t"                                         \
+               "ld r29, x+\n\t"                                                \
+               "out __SP_H__, r29\n\t"                                         \
+               "pop r29\n\t"                                                   \
+               "pop r28\n\t"                                                   \
+               "pop r17\n\t"                                                   \
+               "pop r16\n\t"                                                   \
+               "pop r15\n\t"                                                   \
+               "pop r14\n\t"                                                   \
+               "pop r13\n\t"                                                   \
+               "pop r12\n\t"                                                   \
+               "pop r11\n\t"                                                   \
+               "pop r10\n\t"                                                   \
+               "pop r9\n\t"                                                    \
+               "pop r8\n\t"                                                    \
+               "pop r7\n\t"                                                    \
+               "pop r6\n\t"                                                    \
+               "pop r5\n\t"                                                    \
+               "pop r4\n\t"                                                    \
+               "pop r3\n\t"                                                    \
+               "pop r2");
+#endif
 
 /**
  * @brief Representation of task.
  *
  */
 struct task {
-  uint8_t *stack_top;              ///< Top of tasks stack (sp)
-  uint8_t *stack;                  ///< Start of stack (low address)
-  uint8_t priority;                ///< Priority of task
-  task_state_t state;              ///< Current state of task
-  uint16_t wake_tick;              ///< Tick which the tasks should be waken
-  void *channel;                   ///< Channel that tasks blocked/suspended
-  char name[TASK_NAME_LENGTH + 1]; ///< Name of the task (for debugging)
+  uint8_t *stack_top; ///< Top of tasks stack (sp)
+  uint8_t *stack;     ///< Start of stack (low address)
+  uint8_t priority;   ///< Priority of task
+  uint8_t state;      ///< Current state of task (task_state_t)
+  tick_t wake_tick;   ///< Tick which the tasks should be waken
+  void *channel;      ///< Channel that tasks blocked/suspended
+  uint8_t joiners;    ///< Number of tasks waiting for task to end
+  bool detached;      ///< Joined or detached, freed once it ends
+#if AVRTOS_USE_TRACE
+  uint8_t id; ///< Id of the task in trace records
+#endif
+#if AVRTOS_SCHED_EDF
+  tick_t deadline;          ///< Absolute deadline of current period
+  tick_t release;           ///< Start tick of current period
+  tick_t relative_deadline; ///< Ticks from release to deadline, 0 if none
+  tick_t period;            ///< Ticks between releases
+  uint16_t deadline_misses; ///< Number of periods finished late
+#endif
+#if AVRTOS_TASK_NAME_LENGTH > 0
+  char name[AVRTOS_TASK_NAME_LENGTH + 1]; ///< Name of the task (for debugging)
+#endif
 };
 
 /**
@@ -132,6 +334,7 @@ typedef struct task_queue {
   task_t *tasks;    ///< Tasks
 } task_queue_t;
 
+#if AVRTOS_USE_SEMAPHORE
 /**
  * @brief Semaphore for mutex
  *
@@ -140,7 +343,9 @@ struct semaphore {
   uint8_t count; ///< Count of semaphore
   void *channel; ///< Channel of semaphore
 };
+#endif
 
+#if AVRTOS_USE_QUEUE
 /**
  * @brief FIFO queue for inter-task communication
  *
@@ -157,223 +362,622 @@ struct queue {
   void *read_channel;  ///< Read channel
   void *write_channel; ///< Write channel
 };
+#endif
 
-static task_t current_task; ///< Currently running task
-
-static task_queue_t ready_tasks; ///< Queue of ready tasks
-
-static task_queue_t blocked_tasks; ///< Queue of blocked tasks
+#if AVRTOS_USE_MAILBOX
+/**
+ * @brief Mailbox keeping only the latest item, read with a sequence counter
+ *
+ */
+struct mailbox {
+  volatile uint16_t sequence; ///< Sequence counter, odd while writing
+  uint8_t item_size;          ///< Size of the item stored in mailbox
+  uint16_t version;           ///< Number of writes, 0 if never written
+  uint8_t *item;              ///< Buffer to store the item
 
-static task_queue_t suspended_tasks; ///< Queue of suspended tasks
+  uint8_t waiting; ///< Number of tasks waiting for a newer version
 
-static uint16_t global_tick_count; ///< Tick count from the start of scheduler
+  void *channel; ///< Channel of tasks waiting for a newer version
+};
+#endif
 
-static semaphore_t uart_sem;
+#if AVRTOS_USE_TOPIC
+/**
+ * @brief Ring of the last published messages shared by all subscribers
+ *
+ */
+struct topic {
+  uint8_t capacity;   ///< Number of messages kept
+  uint8_t item_size;  ///< Size of messages
+  uint8_t *items;     ///< Ring buffer of messages
+  uint8_t head;       ///< Slot the next message is written to
+  uint16_t published; ///< Number of published messages, wraps around
 
-static inline double log2(double x) { return log(x) / M_LN2; }
+  uint8_t waiting; ///< Number of subscribers waiting for a message
 
-static int pow2(int x) {
-  int res = 1;
-  for (int i = 0; i < x; i++) {
-    res *= 2;
-  }
-  return res;
-}
+  void *channel; ///< Channel of waiting subscribers
+};
 
 /**
- * @brief Initialize the stack of task
+ * @brief Read position of one subscriber in a topic
  *
- * @param sp Address the stack pointer points to
- * @param fn Function the task runs
- * @param arg Argument passed to function
  */
-static void task_stack_init(uint8_t *sp, uintptr_t fn, uintptr_t arg) {
-  *sp = fn & 0x00ff;
-  sp--;
-  *sp = (fn >> 8) & 0x00ff;
-  sp--;
-
-  *sp = 0;
-  sp--;
-  *sp = 0x80;
-  sp--;
-  *sp = 0;
-  sp--;
-
-  for (int i = 2; i < 24; i++) {
-    *sp = i;
-    sp--;
-  }
+struct subscriber {
+  topic_t topic;    ///< Subscribed topic
+  uint16_t cursor;  ///< Published count of the next message to read
+  uint16_t dropped; ///< Number of messages overwritten before being read
+};
+#endif
 
-  *sp = arg & 0xff;
-  sp--;
-  *sp = (arg >> 8) & 0xff;
-  sp--;
+#if AVRTOS_USE_RWLOCK
+/**
+ * @brief Reader-writer lock preferring writers
+ *
+ */
+struct rwlock {
+  uint8_t readers;         ///< Number of tasks holding the lock for reading
+  bool writer;             ///< Lock is held for writing
+  uint8_t writers_waiting; ///< Number of tasks waiting to write
 
-  for (int i = 26; i < 32; i++) {
-    *sp = i;
-    sp--;
-  }
-}
+  void *read_channel;  ///< Read channel
+  void *write_channel; ///< Write channel
+};
+#endif
 
+#if AVRTOS_USE_COND
 /**
- * @brief Create a task
+ * @brief Condition variable
  *
- * @param fn Function the task runs
- * @param arg Argument passed to function
- * @param name Name of the task (For debugging)
- * @param stack_size Size of the tasks stack
- * @param priority Priority of the task
- * @return task_t
  */
-static task_t task_create(void (*fn)(void *), void *arg, const char *name,
-                          size_t stack_size, uint8_t priority) {
-  task_t task = malloc(sizeof(*task));
-  if (task == NULL) {
-    goto task_error;
-  }
+struct cond {
+  void *channel; ///< Channel of waiting tasks
+};
+#endif
 
-  uint8_t *stack = malloc(stack_size);
-  if (stack == NULL) {
-    goto stack_error;
-  }
-  uint8_t *stack_top = stack + stack_size - 1;
-  task_stack_init(stack_top, (uintptr_t)fn, (uintptr_t)arg);
-  stack_top -= TASK_CONTEXT_SIZE;
+#if AVRTOS_USE_CORO
+/**
+ * @brief Stackless coroutine. It is kept in the task queues like a task
+ * without a stack, and run by the coroutine runner task when it is ready
+ *
+ */
+struct coro {
+  struct task task;                        ///< Scheduling state, stack is NULL
+  coro_status (*fn)(coro_t coro, void *arg); ///< Function of coroutine
+  void *arg;                               ///< Argument passed to function
+  uint16_t lc;                             ///< Line to continue from
+  bool timed;                              ///< Current wait has a timeout
+  bool waiting;                            ///< Wait is counted by a queue
+};
+#endif
 
-  task->stack = stack;
-  task->stack_top = stack_top;
-  task->priority = priority;
-  task->state = READY;
-  task->channel = NULL;
-  strncpy(task->name, name, TASK_NAME_LENGTH);
-  task->name[TASK_NAME_LENGTH] = '\0';
+#if AVRTOS_USE_WORK
+/**
+ * @brief Function deferred to the worker task
+ *
+ */
+typedef struct work_item {
+  void (*fn)(void *); ///< Function to run
+  void *arg;          ///< Argument passed to function
+} work_item_t;
+#endif
 
-  return task;
+#if AVRTOS_USE_ADC
+/**
+ * @brief Scan of ADC channels into a ring buffer of blocks
+ *
+ */
+typedef struct adc_scan {
+  bool running;               ///< Scan is started
+  adc_trigger trigger;        ///< Trigger source of conversions
+  uint8_t pins[ADC_MAX_PINS]; ///< Channels to scan
+  uint8_t pin_count;          ///< Number of channels
+  uint8_t conversion;         ///< Index of channel being converted
+  uint8_t next;               ///< Index of channel converted after
+  uint8_t expected;           ///< Index of channel to store next
+  uint16_t *buffer;           ///< Ring buffer of blocks
+  uint8_t block_size;         ///< Number of samples in a block
+  uint8_t block_count;        ///< Number of blocks in buffer
+  uint16_t write;             ///< Index of next sample to write
+  uint8_t read_block;         ///< Index of oldest filled block
+  uint8_t filled;             ///< Number of filled blocks
+  uint8_t overruns;           ///< Number of overwritten blocks
+} adc_scan_t;
+#endif
 
-stack_error:
-  free(task);
-task_error:
-  return NULL;
-}
+#if AVRTOS_USE_SPI
+/**
+ * @brief SPI transfer waiting in the transaction queue
+ *
+ */
+typedef struct spi_transaction {
+  struct spi_transaction *next; ///< Next transaction in queue
+  uint8_t cs_pin;               ///< Chip select pin
+  const uint8_t *tx;            ///< Bytes to send
+  uint8_t *rx;                  ///< Buffer for received bytes
+  uint16_t length;              ///< Number of bytes
+  uint16_t index;               ///< Index of byte being transferred
+  volatile bool done;           ///< Transfer is completed
+} spi_transaction_t;
+#endif
 
+#if AVRTOS_USE_TWI
 /**
- * @brief Swap two tasks
+ * @brief TWI transfer handled by the TWI interrupt
  *
- * @param x
- * @param y
  */
-static void task_swap(task_t *x, task_t *y) {
-  task_t tmp = *x;
-  *x = *y;
-  *y = tmp;
-}
+typedef struct twi_transfer {
+  uint8_t address;    ///< 7-bit slave address
+  const uint8_t *tx;  ///< Bytes to write
+  uint8_t tx_length;  ///< Number of bytes to write
+  uint8_t *rx;        ///< Buffer for read bytes
+  uint8_t rx_length;  ///< Number of bytes to read
+  uint8_t index;      ///< Index of byte being transferred
+  bool reading;       ///< Write part is completed
+  volatile bool done; ///< Transfer is completed
+  twi_status status;  ///< Result of transfer
+} twi_transfer_t;
+#endif
 
+#if AVRTOS_USE_PWM
 /**
- * @brief Bubble up the higher priority task
+ * @brief Output compare channel of a PWM timer
  *
- * @param queue Task priority queue
- * @param idx Initial index of the task
  */
-static void task_queue_bubble_down(task_queue_t *queue, uint8_t idx) {
-  while (2 * idx + 1 < queue->length) {
-    uint8_t left_child = 2 * idx + 1;
-    uint8_t right_child = 2 * idx + 2;
-    uint8_t max_child = (queue->tasks[left_child]->priority >
-                         queue->tasks[right_child]->priority)
-                            ? left_child
-                            : right_child;
-    if (queue->tasks[idx]->priority < queue->tasks[max_child]->priority) {
-      task_swap(&queue->tasks[idx], &queue->tasks[max_child]);
-      idx = max_child;
-    } else {
-      break;
-    }
-  }
-}
+typedef struct pwm_channel {
+  uint8_t pin;            ///< Arduino pin of output
+  pwm_timer timer;        ///< Timer of channel
+  bool channel_a;         ///< Channel is A, which is TOP with custom top
+  volatile uint8_t *tccr; ///< Control register A of timer
+  volatile uint8_t *ocr;  ///< Output compare register
+  uint8_t com;            ///< Non-inverting compare output mode bit
+} pwm_channel_t;
+#endif
 
+#if AVRTOS_USE_GPIO_IRQ
 /**
- * @brief Bubble down the lower priority task
+ * @brief Interrupt state of a GPIO pin
  *
- * @param queue Task priority queue
- * @param idx Initial index of the task
  */
-static void task_queue_bubble_up(task_queue_t *queue, uint8_t idx) {
-  while (idx > 0 &&
-         queue->tasks[idx]->priority > queue->tasks[(idx - 1) / 2]->priority) {
-    task_swap(&queue->tasks[idx], &queue->tasks[(idx - 1) / 2]);
-    idx = (idx - 1) / 2;
-  }
-}
+typedef struct gpio_irq {
+  gpio_edge edge;                         ///< Edges to deliver
+  tick_t debounce;                        ///< Ticks to ignore edges
+  bool delivered;                         ///< An edge was delivered before
+  bool pending;                           ///< Edge is not read by a task
+  gpio_event_t event;                     ///< Last delivered edge
+  void (*callback)(const gpio_event_t *); ///< Called for delivered edges
+} gpio_irq_t;
+#endif
 
+#if AVRTOS_USE_EEPROM
 /**
- * @brief Insert task into priority queue
+ * @brief Byte waiting to be written to EEPROM
  *
- * @param queue Task queue
- * @param task Task
- * @return bool
  */
-static bool task_queue_insert(task_queue_t *queue, task_t task) {
-  uint8_t level = log2(queue->length + 1);
-  uint8_t exp_cap = (uint8_t)(pow2(level + 1)) - 1;
+typedef struct eeprom_entry {
+  uint16_t address; ///< EEPROM address
+  uint8_t value;    ///< Byte to write
+} eeprom_entry_t;
+#endif
 
-  if (queue->capacity < exp_cap) {
-    task_t *tmp = realloc(queue->tasks, sizeof(task_t) * exp_cap);
-    if (tmp == NULL) {
-      return false;
-    }
-    queue->tasks = tmp;
-    queue->capacity = exp_cap;
-  }
+static task_t current_task; ///< Currently running task
 
-  queue->tasks[queue->length] = task;
-  task_queue_bubble_up(queue, queue->length);
-  queue->length++;
+static task_queue_t ready_tasks; ///< Queue of ready tasks
 
-  return true;
-}
+static task_queue_t blocked_tasks; ///< Queue of blocked tasks
+
+static task_queue_t suspended_tasks; ///< Queue of suspended tasks
+
+static task_queue_t dead_tasks; ///< Queue of ended tasks waiting to be freed
+
+static tick_t global_tick_count; ///< Tick count from the start of scheduler
+
+static task_t idle_task; ///< Task running when no other task is ready
 
 /**
- * @brief Remove a task from the queue
+ * @brief Stack shared by the tick, context switches and driver ISRs
  *
- * @param queue Task queue
- * @param task Task
- * @return bool
  */
-static bool task_queue_delete(task_queue_t *queue, task_t task) {
-  uint8_t i;
-  for (i = 0; i < queue->length; i++) {
-    if (queue->tasks[i] == task) {
-      break;
-    }
-  }
+static uint8_t system_stack[AVRTOS_SYSTEM_STACK_SIZE];
 
-  if (i == queue->length) {
-    return false;
-  }
+static uint8_t scheduler_locks; ///< Nesting count of scheduler_lock
 
-  queue->length--;
-  queue->tasks[i] = queue->tasks[queue->length];
-  task_queue_bubble_down(queue, i);
+static bool switch_pending; ///< A switch was postponed while locked
 
-  return true;
-}
+static bool need_switch; ///< A task higher than the running one was woken
 
 /**
- * @brief Top of the queue
+ * @brief Channel of tasks parked by task_suspend, no primitive wakes it
  *
- * @param queue Task queue
- * @return task_t
  */
-static task_t task_queue_top(task_queue_t *queue) {
-  if (queue->length == 0) {
-    return NULL;
-  }
-  return queue->tasks[0];
-}
+#define TASK_PARKED ((void *)&suspended_tasks)
 
+#if AVRTOS_USE_CORO
+static task_queue_t coro_ready; ///< Queue of ready coroutines
+
+static task_t coro_runner; ///< Task running coroutines on its stack
+#endif
+
+#if AVRTOS_USE_TT
+static task_t tt_task; ///< Task running the slots, outside of every queue
+
+static const tt_slot_t *tt_table; ///< Schedule table in flash
+
+static uint8_t tt_slot_count; ///< Number of slots in the table
+
+static uint8_t tt_frames; ///< Minor frames (ticks) in the major cycle
+
+static uint8_t tt_frame; ///< Minor frame of the current tick
+
+static uint16_t tt_overrun_count; ///< Frames skipped because of an overrun
+#endif
+
+#if AVRTOS_USE_STATS
+static tick_t idle_ticks; ///< Ticks the idle task was running on
+
+static uint16_t context_switches; ///< Number of context switches
+#endif
+
+#if AVRTOS_USE_WORK
+static work_item_t work_queue[AVRTOS_WORK_QUEUE_SIZE]; ///< Ring of work items
+
+static uint8_t work_head; ///< Number of submitted items, wraps around
+
+static volatile uint8_t work_tail; ///< Number of taken items, wraps around
+
+static bool work_waiting; ///< Worker task is suspended on empty queue
+
+static uint8_t work_high_water; ///< Highest depth of work queue
+
+static uint16_t work_drops; ///< Number of dropped work items
+
+static task_t work_task; ///< The only worker, it alone advances the tail
+#endif
+
+#if AVRTOS_USE_UART
+static semaphore_t uart_sem; ///< Lock of the standard output
+#endif
+
+#if AVRTOS_USE_ADC
+static semaphore_t adc_sem; ///< Owner of the ADC
+
+static uint8_t adc_reference_bits; ///< REFS bits of ADMUX
+
+static volatile uint16_t adc_value; ///< Result of single conversion
+
+static volatile bool adc_done; ///< Single conversion is completed
+
+static adc_scan_t adc_scan; ///< Current ADC scan
+#endif
+
+#if AVRTOS_USE_SPI
+static spi_transaction_t *spi_head; ///< Transaction being transferred
+
+static spi_transaction_t *spi_tail; ///< Last queued transaction
+#endif
+
+#if AVRTOS_USE_TWI
+static semaphore_t twi_sem; ///< Lock of the TWI bus
+
+static twi_transfer_t *twi_current; ///< Transfer on the bus
+#endif
+
+#if AVRTOS_USE_PWM
 /**
- * @brief Create a task and put it into ready tasks queue
+ * @brief PWM outputs of timer 0 and timer 2
+ *
+ */
+static const pwm_channel_t pwm_channels[] = {
+    {6, PWM_TIMER0, true, &TCCR0A, &OCR0A, _BV(COM0A1)},
+    {5, PWM_TIMER0, false, &TCCR0A, &OCR0B, _BV(COM0B1)},
+    {11, PWM_TIMER2, true, &TCCR2A, &OCR2A, _BV(COM2A1)},
+    {3, PWM_TIMER2, false, &TCCR2A, &OCR2B, _BV(COM2B1)},
+};
+
+static uint8_t pwm_top[2] = {0xff, 0xff}; ///< Top of PWM timers
+#endif
+
+#if AVRTOS_USE_GPIO_IRQ
+static gpio_irq_t *gpio_irqs[A5 + 1]; ///< Interrupt states of pins
+
+static uint8_t gpio_pcint_levels[3]; ///< Last levels of ports B, C and D
+#endif
+
+#if AVRTOS_USE_EEPROM
+static eeprom_entry_t eeprom_queue[AVRTOS_EEPROM_QUEUE_SIZE]; ///< Write queue
+
+static uint8_t eeprom_head; ///< Index of oldest entry in write queue
+
+static uint8_t eeprom_length; ///< Number of entries in write queue
+
+static bool eeprom_writing; ///< Oldest entry is being written
+
+static uint8_t eeprom_readers; ///< Number of tasks waiting to read
+#endif
+
+#if AVRTOS_USE_TRACE
+static trace_record_t trace_buffer[AVRTOS_TRACE_BUFFER_SIZE]; ///< Records
+
+static uint8_t trace_head; ///< Index of next record to write
+
+static uint8_t trace_length; ///< Number of records in buffer
+
+static uint8_t trace_byte; ///< Byte of oldest record being streamed
+
+static bool trace_enabled; ///< Events are recorded
+
+static trace_mode trace_current_mode; ///< Mode of recording
+
+static tick_t trace_last_tick; ///< Tick of the last record
+
+static uint16_t trace_dropped; ///< Records dropped while streaming
+
+static uint8_t trace_next_id; ///< Id of next created task
+
+/**
+ * @brief Record an event of a task
+ *
+ */
+#define TRACE(event, task, object)                                             \
+  trace_record(event, (task)->id, (uint16_t)(uintptr_t)(object))
+#else
+#define TRACE(event, task, object)
+#endif
+
+#if AVRTOS_PROFILE_CRITICAL
+static critical_profile_t critical_profile; ///< Longest critical section
+
+static bool critical_active;      ///< Interrupts are disabled by critical_enter
+static uint16_t critical_start;   ///< Timer value at the start of the section
+static const char *critical_file; ///< File of the current critical section
+static uint16_t critical_line;    ///< Line of the current critical section
+#endif
+
+#if AVRTOS_PROFILE_CRITICAL
+/**
+ * @brief Enter a critical section and start measuring it if it is the
+ * outermost one
+ *
+ * @param file File of the critical section (in program memory)
+ * @param line Line of the critical section
+ * @return uint8_t Status register to pass to critical_exit
+ */
+uint8_t critical_enter_at(const char *file, uint16_t line) {
+  uint8_t sreg = SREG;
+  cli();
+
+  if (sreg & _BV(SREG_I)) {
+    critical_start = TCNT1;
+    critical_file = file;
+    critical_line = line;
+    critical_active = true;
+  }
+
+  return sreg;
+}
+
+/**
+ * @brief Stop measuring the current critical section and record it if it is
+ * the longest so far
+ *
+ */
+static void critical_profile_stop(void) {
+  if (!critical_active) {
+    return;
+  }
+
+  uint16_t now = TCNT1;
+  uint16_t time = (now >= critical_start)
+                      ? now - critical_start
+                      : now + OCR1A + 1 - critical_start;
+
+  if (time > critical_profile.max_time) {
+    critical_profile.max_time = time;
+    critical_profile.file = critical_file;
+    critical_profile.line = critical_line;
+  }
+  critical_active = false;
+}
+
+/**
+ * @brief Leave a critical section
+ *
+ * @param sreg Status register returned by critical_enter
+ */
+void critical_exit(uint8_t sreg) {
+  if (sreg & _BV(SREG_I)) {
+    critical_profile_stop();
+  }
+  asm volatile("" ::: "memory");
+  SREG = sreg;
+}
+
+/**
+ * @brief Get the longest critical section recorded so far
+ *
+ * @param profile Profile to fill
+ */
+void critical_profile_get(critical_profile_t *profile) {
+  uint8_t sreg = SREG;
+  cli();
+  *profile = critical_profile;
+  SREG = sreg;
+}
+
+/**
+ * @brief Clear the recorded critical sections
+ *
+ */
+void critical_profile_reset(void) {
+  uint8_t sreg = SREG;
+  cli();
+  critical_profile.max_time = 0;
+  critical_profile.file = NULL;
+  critical_profile.line = 0;
+  SREG = sreg;
+}
+#endif
+
+#if AVRTOS_USE_TRACE
+/**
+ * @brief Put a record into the trace buffer
+ *
+ * @warning Must be called inside a critical section
+ *
+ * @param event Event of record
+ * @param id Id of task
+ * @param object Object of record
+ */
+static void trace_put(uint8_t event, uint8_t id, uint16_t object) {
+  uint16_t time = TCNT1;
+  if (TIFR1 & _BV(OCF1A)) {
+    time = TCNT1 + OCR1A + 1; // Tick interrupt is pending
+  }
+
+  if (trace_length == AVRTOS_TRACE_BUFFER_SIZE) {
+    if (trace_current_mode == TRACE_STREAM) {
+      trace_dropped++;
+      return;
+    }
+    trace_length--; // Overwrite the oldest record
+  }
+
+  trace_record_t *record = &trace_buffer[trace_head];
+  record->event = event;
+  record->task = id;
+  record->time = time;
+  record->object = object;
+  trace_head = (trace_head + 1) & (AVRTOS_TRACE_BUFFER_SIZE - 1);
+  trace_length++;
+}
+
+/**
+ * @brief Record an event, preceded by a tick record if it is the first one of
+ * the tick
+ *
+ * @param event Event of record
+ * @param id Id of task
+ * @param object Object of record
+ */
+static void trace_record(uint8_t event, uint8_t id, uint16_t object) {
+  if (!trace_enabled) {
+    return;
+  }
+
+  uint8_t sreg = critical_enter();
+  if (trace_last_tick != global_tick_count) {
+    trace_last_tick = global_tick_count;
+    trace_put(TRACE_TICK, 0xff, global_tick_count);
+  }
+  trace_put(event, id, object);
+  if (trace_current_mode == TRACE_STREAM) {
+    UCSR0B |= _BV(UDRIE0);
+  }
+  critical_exit(sreg);
+}
+#endif
+
+#if AVRTOS_COOPERATIVE
+/**
+ * @brief First code a cooperative task runs. The context restores only the
+ * call-saved registers, so the argument comes in r2:r3 and is moved to the
+ * argument register before returning into the task function
+ *
+ */
+static void task_start(void) __attribute__((naked, used));
+static void task_start(void) {
+  asm volatile("movw r24, r2\n\t"
+               "ret");
+}
+#endif
+
+/**
+ * @brief Initialize the stack of task. The address of task_exit is pushed
+ * under the context, so returning from fn ends the task
+ *
+ * @param sp Address the stack pointer points to
+ * @param fn Function the task runs
+ * @param arg Argument passed to function
+ * @return uint8_t* Stack pointer of the initialized task
+ */
+static uint8_t *task_stack_init(uint8_t *sp, uintptr_t fn, uintptr_t arg) {
+  uintptr_t ret = (uintptr_t)task_exit;
+  *sp = ret & 0x00ff;
+  sp--;
+  *sp = (ret >> 8) & 0x00ff;
+  sp--;
+#if defined(__AVR_3_BYTE_PC__)
+  *sp = 0; // Function pointers are word addresses in the low 128 KB
+  sp--;
+#endif
+
+  *sp = fn & 0x00ff;
+  sp--;
+  *sp = (fn >> 8) & 0x00ff;
+  sp--;
+#if defined(__AVR_3_BYTE_PC__)
+  *sp = 0;
+  sp--;
+#endif
+
+#if AVRTOS_COOPERATIVE
+  uintptr_t start = (uintptr_t)task_start;
+  *sp = start & 0x00ff;
+  sp--;
+  *sp = (start >> 8) & 0x00ff;
+  sp--;
+#if defined(__AVR_3_BYTE_PC__)
+  *sp = 0;
+  sp--;
+#endif
+
+  *sp = arg & 0xff; // r2
+  sp--;
+  *sp = (arg >> 8) & 0xff; // r3
+  sp--;
+
+  for (int i = 4; i < 18; i++) {
+    *sp = i;
+    sp--;
+  }
+  *sp = 28;
+  sp--;
+  *sp = 29;
+  sp--;
+#else
+  *sp = 0;
+  sp--;
+  *sp = 0x80;
+  sp--;
+#if defined(__AVR_3_BYTE_PC__)
+  *sp = 0; // RAMPZ
+  sp--;
+  *sp = 0; // EIND
+  sp--;
+#endif
+  *sp = 0;
+  sp--;
+
+  for (int i = 2; i < 24; i++) {
+    *sp = i;
+    sp--;
+  }
+
+  *sp = arg & 0xff;
+  sp--;
+  *sp = (arg >> 8) & 0xff;
+  sp--;
+
+  for (int i = 26; i < 32; i++) {
+    *sp = i;
+    sp--;
+  }
+#endif
+
+  return sp;
+}
+
+/**
+ * @brief Create a task
  *
  * @param fn Function the task runs
  * @param arg Argument passed to function
@@ -382,575 +986,3846 @@ static task_t task_queue_top(task_queue_t *queue) {
  * @param priority Priority of the task
  * @return task_t
  */
-task_t task_init(void (*fn)(void *), void *arg, const char *name,
-                 size_t stack_size, uint8_t priority) {
-  task_t task = task_create(fn, arg, name, stack_size, priority);
-  if (task == NULL) {
-    goto task_error;
+static task_t task_create(void (*fn)(void *), void *arg, const char *name,
+                          size_t stack_size, uint8_t priority) {
+  task_t task = malloc(sizeof(*task));
+  if (task == NULL) {
+    goto task_error;
+  }
+
+  uint8_t *stack = malloc(stack_size);
+  if (stack == NULL) {
+    goto stack_error;
+  }
+  uint8_t *stack_top =
+      task_stack_init(stack + stack_size - 1, (uintptr_t)fn, (uintptr_t)arg);
+
+  task->stack = stack;
+  task->stack_top = stack_top;
+  task->priority = priority;
+  task->state = READY;
+  task->channel = NULL;
+  task->joiners = 0;
+  task->detached = false;
+#if AVRTOS_USE_TRACE
+  task->id = trace_next_id++;
+#endif
+#if AVRTOS_SCHED_EDF
+  task->relative_deadline = 0;
+  task->deadline_misses = 0;
+#endif
+#if AVRTOS_TASK_NAME_LENGTH > 0
+  strncpy(task->name, name, AVRTOS_TASK_NAME_LENGTH);
+  task->name[AVRTOS_TASK_NAME_LENGTH] = '\0';
+#else
+  (void)name;
+#endif
+
+  return task;
+
+stack_error:
+  free(task);
+task_error:
+  return NULL;
+}
+
+/**
+ * @brief Free the stack and handle of a task
+ *
+ * @param task Task
+ */
+static void task_free(task_t task) {
+  free(task->stack);
+  free(task);
+}
+
+/**
+ * @brief Swap two tasks
+ *
+ * @param x
+ * @param y
+ */
+static void task_swap(task_t *x, task_t *y) {
+  task_t tmp = *x;
+  *x = *y;
+  *y = tmp;
+}
+
+/**
+ * @brief Whether task a should run before task b. Tasks with a deadline are
+ * ordered by deadline and run before tasks without one, which are ordered by
+ * priority
+ *
+ * @param a
+ * @param b
+ * @return bool
+ */
+static bool task_higher(task_t a, task_t b) {
+#if AVRTOS_SCHED_EDF
+  if (a->relative_deadline && b->relative_deadline) {
+    return (tick_diff_t)(a->deadline - b->deadline) < 0;
+  }
+  if (a->relative_deadline || b->relative_deadline) {
+    return a->relative_deadline != 0;
+  }
+#endif
+  return a->priority > b->priority;
+}
+
+/**
+ * @brief Bubble up the higher priority task
+ *
+ * @param queue Task priority queue
+ * @param idx Initial index of the task
+ */
+static void task_queue_bubble_down(task_queue_t *queue, uint8_t idx) {
+  while (2 * idx + 1 < queue->length) {
+    uint8_t left_child = 2 * idx + 1;
+    uint8_t right_child = 2 * idx + 2;
+    uint8_t max_child = left_child;
+    if (right_child < queue->length &&
+        task_higher(queue->tasks[right_child], queue->tasks[left_child])) {
+      max_child = right_child;
+    }
+    if (task_higher(queue->tasks[max_child], queue->tasks[idx])) {
+      task_swap(&queue->tasks[idx], &queue->tasks[max_child]);
+      idx = max_child;
+    } else {
+      break;
+    }
+  }
+}
+
+/**
+ * @brief Bubble down the lower priority task
+ *
+ * @param queue Task priority queue
+ * @param idx Initial index of the task
+ */
+static void task_queue_bubble_up(task_queue_t *queue, uint8_t idx) {
+  while (idx > 0 &&
+         task_higher(queue->tasks[idx], queue->tasks[(idx - 1) / 2])) {
+    task_swap(&queue->tasks[idx], &queue->tasks[(idx - 1) / 2]);
+    idx = (idx - 1) / 2;
+  }
+}
+
+/**
+ * @brief Insert task into priority queue
+ *
+ * @param queue Task queue
+ * @param task Task
+ * @return bool
+ */
+static bool task_queue_insert(task_queue_t *queue, task_t task) {
+  if (queue->length == queue->capacity) {
+    // Grow by one level of the heap: 1, 3, 7, 15...
+    uint8_t capacity = queue->capacity * 2 + 1;
+    task_t *tmp = realloc(queue->tasks, sizeof(task_t) * capacity);
+    if (tmp == NULL) {
+      return false;
+    }
+    queue->tasks = tmp;
+    queue->capacity = capacity;
+  }
+
+  queue->tasks[queue->length] = task;
+  task_queue_bubble_up(queue, queue->length);
+  queue->length++;
+
+  return true;
+}
+
+/**
+ * @brief Remove a task from the queue
+ *
+ * @param queue Task queue
+ * @param task Task
+ * @return bool
+ */
+static bool task_queue_delete(task_queue_t *queue, task_t task) {
+  uint8_t i;
+  for (i = 0; i < queue->length; i++) {
+    if (queue->tasks[i] == task) {
+      break;
+    }
+  }
+
+  if (i == queue->length) {
+    return false;
+  }
+
+  queue->length--;
+  if (i < queue->length) {
+    queue->tasks[i] = queue->tasks[queue->length];
+    task_queue_bubble_down(queue, i);
+    task_queue_bubble_up(queue, i);
+  }
+
+  return true;
+}
+
+/**
+ * @brief Top of the queue
+ *
+ * @param queue Task queue
+ * @return task_t
+ */
+static task_t task_queue_top(task_queue_t *queue) {
+  if (queue->length == 0) {
+    return NULL;
+  }
+  return queue->tasks[0];
+}
+
+/**
+ * @brief Queue the task is kept in for its state
+ *
+ * @param task Task
+ * @return task_queue_t* NULL if task is terminated
+ */
+static task_queue_t *task_queue_of(task_t task) {
+  switch (task->state) {
+  case RUNNING:
+  case READY:
+    return &ready_tasks;
+  case BLOCKED:
+    return &blocked_tasks;
+  case SUSPENDED:
+    return &suspended_tasks;
+  default:
+    return NULL;
+  }
+}
+
+/**
+ * @brief Restore the order of the queue holding a task after its priority or
+ * deadline changed
+ *
+ * @warning Must be called inside a critical section
+ *
+ * @param task Task
+ */
+static void task_requeue(task_t task) {
+  task_queue_t *queue = task_queue_of(task);
+  if (queue != NULL) {
+    task_queue_delete(queue, task);
+    task_queue_insert(queue, task);
+  }
+}
+
+/**
+ * @brief Create a task and put it into ready tasks queue
+ *
+ * @param fn Function the task runs
+ * @param arg Argument passed to function
+ * @param name Name of the task (For debugging)
+ * @param stack_size Size of the tasks stack
+ * @param priority Priority of the task
+ * @return task_t
+ */
+task_t task_init(void (*fn)(void *), void *arg, const char *name,
+                 size_t stack_size, uint8_t priority) {
+  task_t task = task_create(fn, arg, name, stack_size, priority);
+  if (task == NULL) {
+    goto task_error;
+  }
+
+  uint8_t sreg = critical_enter();
+  if (!task_queue_insert(&ready_tasks, task)) {
+    critical_exit(sreg);
+    goto insert_error;
+  }
+  TRACE(TRACE_TASK_CREATE, task, priority);
+  critical_exit(sreg);
+
+  return task;
+
+insert_error:
+  task_free(task);
+task_error:
+  return NULL;
+}
+
+/**
+ * @brief Task to run next. A released time-triggered frame runs before every
+ * ready task
+ *
+ * @return task_t
+ */
+static task_t scheduler_next(void) {
+#if AVRTOS_USE_TT
+  if (tt_task != NULL && tt_task->state != SUSPENDED) {
+    return tt_task;
+  }
+#endif
+  return task_queue_top(&ready_tasks);
+}
+
+#if AVRTOS_USE_TT
+/// A minor frame was released by the tick and has not started yet
+#define TT_RELEASED() (tt_task != NULL && tt_task->state == READY)
+#else
+#define TT_RELEASED() false
+#endif
+
+/**
+ * @brief Pick the task a switch continues with. Runs on the system stack
+ * between saving and restoring the context
+ *
+ */
+static void task_switch_body(void) __attribute__((used));
+static void task_switch_body(void) {
+#if AVRTOS_PROFILE_CRITICAL
+  critical_profile_stop();
+#endif
+
+#if AVRTOS_USE_STATS
+  context_switches++;
+#endif
+
+  task_t previous_task = current_task;
+  if (previous_task->state == RUNNING) {
+    previous_task->state = READY; // preempted
+  }
+  need_switch = false;
+  current_task = scheduler_next();
+  current_task->state = RUNNING;
+  TRACE(TRACE_SWITCH, current_task, previous_task);
+}
+
+/**
+ * @brief Yield the execution of the task. Naked functions only hold basic
+ * asm, the switch itself is done by task_switch_body
+ *
+ */
+static void task_switch(void) __attribute__((naked));
+static void task_switch(void) {
+  SAVE_CONTEXT();
+  ENTER_SYSTEM_STACK();
+  asm volatile("call task_switch_body");
+  RESTORE_CONTEXT();
+  asm volatile("reti");
+}
+
+/**
+ * @brief Move the running task from ready tasks to a wait queue and switch to
+ * the next task. A task parked by task_suspend while it was running stays
+ * parked
+ *
+ * @warning Must be called inside a critical section
+ *
+ * @param queue Queue to wait in
+ * @param state State of the waiting task
+ * @param chan Channel to wait on
+ */
+static void task_sleep(task_queue_t *queue, uint8_t state, void *chan) {
+  if (current_task->state == RUNNING) {
+    current_task->channel = chan;
+    current_task->state = state;
+    task_queue_delete(&ready_tasks, current_task);
+    task_queue_insert(queue, current_task);
+  }
+  task_switch();
+  cli(); // task_switch returns with interrupts enabled
+}
+
+/**
+ * @brief Let the other ready tasks with the same or higher priority run
+ * before the running task continues
+ *
+ */
+void task_yield(void) {
+  uint8_t sreg = critical_enter();
+  if (current_task->state == RUNNING) {
+    if (task_queue_delete(&ready_tasks, current_task)) {
+      task_queue_insert(&ready_tasks, current_task);
+    }
+  }
+  if (scheduler_next() != current_task) {
+    task_switch();
+    cli(); // task_switch returns with interrupts enabled
+  }
+  critical_exit(sreg);
+}
+
+/**
+ * @brief Delay the task for specified milliseconds
+ *
+ * @param ms Milliseconds to delay
+ */
+void task_delay(uint16_t ms) {
+  uint8_t sreg = critical_enter();
+  current_task->wake_tick = global_tick_count + ms / 10;
+  task_sleep(&blocked_tasks, BLOCKED, NULL);
+  critical_exit(sreg);
+}
+
+#if AVRTOS_SCHED_EDF
+/**
+ * @brief Make the task periodic with a deadline. It is scheduled by earliest
+ * deadline first, ahead of all the tasks without a deadline. The first period
+ * starts now
+ *
+ * @param task Task handle, NULL for the running task
+ * @param deadline Milliseconds from the start of a period to its deadline
+ * @param period Milliseconds between the starts of periods
+ */
+void task_set_deadline(task_t task, uint16_t deadline, uint16_t period) {
+  uint8_t sreg = critical_enter();
+  if (task == NULL) {
+    task = current_task;
+  }
+  task->relative_deadline = deadline / 10 ? deadline / 10 : 1;
+  task->period = period / 10;
+  task->release = global_tick_count;
+  task->deadline = task->release + task->relative_deadline;
+  task_requeue(task);
+  critical_exit(sreg);
+}
+
+/**
+ * @brief Finish the work of this period and wait for the next one. A miss is
+ * counted if the deadline has passed
+ *
+ */
+void task_wait_period(void) {
+  uint8_t sreg = critical_enter();
+
+  if ((tick_diff_t)(global_tick_count - current_task->deadline) > 0) {
+    current_task->deadline_misses++;
+  }
+  current_task->release += current_task->period;
+  current_task->deadline =
+      current_task->release + current_task->relative_deadline;
+
+  if ((tick_diff_t)(current_task->release - global_tick_count) > 0) {
+    // A resumed task wakes early, sleep again until the release
+    do {
+      current_task->wake_tick = current_task->release;
+      task_sleep(&blocked_tasks, BLOCKED, NULL);
+    } while ((tick_diff_t)(current_task->release - global_tick_count) > 0);
+  } else if (current_task->state == RUNNING) {
+    // Next period already started, keep running with the new deadline. A
+    // task parked by task_suspend is not in ready tasks anymore
+    task_queue_delete(&ready_tasks, current_task);
+    task_queue_insert(&ready_tasks, current_task);
+  }
+
+  critical_exit(sreg);
+}
+
+/**
+ * @brief Number of periods the task finished after their deadline
+ *
+ * @param task Task handle
+ * @return uint16_t
+ */
+uint16_t task_deadline_misses(task_t task) {
+  uint8_t sreg = critical_enter();
+  uint16_t misses = task->deadline_misses;
+  critical_exit(sreg);
+  return misses;
+}
+#endif
+
+/**
+ * @brief Block on channel
+ *
+ * @warning Must be called inside a critical section
+ *
+ * @param chan Channel to block on
+ */
+static void task_block(void *chan) __attribute__((unused));
+static void task_block(void *chan) {
+  TRACE(TRACE_BLOCK, current_task, chan);
+  task_sleep(&blocked_tasks, BLOCKED, chan);
+}
+
+/**
+ * @brief Suspend on channel
+ *
+ * @warning Must be called inside a critical section
+ *
+ * @param chan Channel to suspend on
+ */
+static void task_suspend_on(void *chan) __attribute__((unused));
+static void task_suspend_on(void *chan) {
+  TRACE(TRACE_SUSPEND, current_task, chan);
+  task_sleep(&suspended_tasks, SUSPENDED, chan);
+}
+
+#if AVRTOS_USE_CORO
+/**
+ * @brief Give the coroutine runner the priority of the highest priority ready
+ * coroutine and make it ready if it is waiting for coroutines
+ *
+ * @warning Must be called inside a critical section
+ *
+ */
+static void coro_runner_update(void) {
+  task_t top = task_queue_top(&coro_ready);
+  if (top == NULL) {
+    return;
+  }
+
+  if (coro_runner->state == SUSPENDED) {
+    // Runner is out of every queue, so waking it does not disturb the
+    // queue being scanned by the caller
+    coro_runner->priority = top->priority;
+    coro_runner->state = READY;
+    task_queue_insert(&ready_tasks, coro_runner);
+  } else if (coro_runner->priority != top->priority) {
+    task_queue_delete(&ready_tasks, coro_runner);
+    coro_runner->priority = top->priority;
+    task_queue_insert(&ready_tasks, coro_runner);
+  }
+}
+#endif
+
+/**
+ * @brief Mark a switch if a ready task is higher than the running task. The
+ * switch is done by task_preempt, the ISR exit or scheduler_unlock
+ *
+ * @warning Must be called inside a critical section
+ *
+ * @param task Ready task
+ */
+static void task_check_preempt(task_t task) {
+#if AVRTOS_COOPERATIVE
+  (void)task;
+#else
+  if (current_task != NULL && task != NULL && task != current_task &&
+      task_higher(task, current_task)) {
+    if (scheduler_locks > 0) {
+      switch_pending = true;
+    } else {
+      need_switch = true;
+    }
+  }
+#endif
+}
+
+/**
+ * @brief Put a task which is out of the queues into ready tasks. Coroutines
+ * are put into ready coroutines instead
+ *
+ * @warning Must be called inside a critical section
+ *
+ * @param task Task
+ */
+static void task_ready(task_t task) {
+  task->state = READY;
+#if AVRTOS_USE_CORO
+  if (task->stack == NULL) {
+    task_queue_insert(&coro_ready, task);
+    coro_runner_update();
+    task = coro_runner;
+  } else {
+    task_queue_insert(&ready_tasks, task);
+  }
+#else
+  task_queue_insert(&ready_tasks, task);
+#endif
+
+  task_check_preempt(task);
+}
+
+/**
+ * @brief Yield to a task woken inside the critical section if it is higher
+ * than the running task. Only the outermost critical section of a task
+ * yields, ISRs switch when they exit
+ *
+ * @warning Must be called inside a critical section, before critical_exit
+ *
+ * @param sreg Status register returned by critical_enter
+ */
+static void task_preempt(uint8_t sreg) __attribute__((unused));
+static void task_preempt(uint8_t sreg) {
+  if (need_switch && (sreg & _BV(SREG_I))) {
+    task_switch();
+    cli(); // task_switch returns with interrupts enabled
+  }
+}
+
+/**
+ * @brief Wake the tasks of a queue waiting on channel. The scan restarts
+ * after every removal, because removing reorders the heap
+ *
+ * @param queue Queue of blocked or suspended tasks
+ * @param chan Block/Suspend channel
+ */
+static void task_wake_queue(task_queue_t *queue, void *chan) {
+  uint8_t i = 0;
+  while (i < queue->length) {
+    task_t task = queue->tasks[i];
+    if (task->channel == chan) {
+      TRACE(TRACE_WAKE, task, chan);
+      task->channel = NULL;
+      task_queue_delete(queue, task);
+      task_ready(task);
+      i = 0;
+    } else {
+      i++;
+    }
+  }
+}
+
+/**
+ * @brief Wake all the tasks blocked/suspended on channel
+ *
+ * @param chan Block/Suspend channel
+ */
+static void task_wake(void *chan) __attribute__((unused));
+static void task_wake(void *chan) {
+  task_wake_queue(&blocked_tasks, chan);
+  task_wake_queue(&suspended_tasks, chan);
+}
+
+/**
+ * @brief Wake the highest priority task blocked/suspended on channel
+ *
+ * @param chan Block/Suspend channel
+ * @return bool A task was waiting on channel
+ */
+static bool task_wake_one(void *chan) __attribute__((unused));
+static bool task_wake_one(void *chan) {
+  task_queue_t *queue = NULL;
+  task_t task = NULL;
+
+  for (uint8_t i = 0; i < blocked_tasks.length; i++) {
+    task_t t = blocked_tasks.tasks[i];
+    if (t->channel == chan && (task == NULL || task_higher(t, task))) {
+      queue = &blocked_tasks;
+      task = t;
+    }
+  }
+
+  for (uint8_t i = 0; i < suspended_tasks.length; i++) {
+    task_t t = suspended_tasks.tasks[i];
+    if (t->channel == chan && (task == NULL || task_higher(t, task))) {
+      queue = &suspended_tasks;
+      task = t;
+    }
+  }
+
+  if (task == NULL) {
+    return false;
+  }
+
+  TRACE(TRACE_WAKE, task, chan);
+  task->channel = NULL;
+  task_queue_delete(queue, task);
+  task_ready(task);
+  return true;
+}
+
+/**
+ * @brief Change the priority of a task in whichever queue it is. Switches at
+ * once if a ready task becomes higher than the running task. Can be called
+ * from ISRs
+ *
+ * @param task Task handle, NULL for the running task
+ * @param priority New priority
+ */
+void task_set_priority(task_t task, uint8_t priority) {
+  uint8_t sreg = critical_enter();
+  if (task == NULL) {
+    task = current_task;
+  }
+#if AVRTOS_USE_TT
+  if (task == tt_task) { // runs outside of the queues, before every task
+    critical_exit(sreg);
+    return;
+  }
+#endif
+  task->priority = priority;
+  task_requeue(task);
+  task_check_preempt(task_queue_top(&ready_tasks));
+  task_preempt(sreg);
+  critical_exit(sreg);
+}
+
+/**
+ * @brief Get the priority of a task
+ *
+ * @param task Task handle, NULL for the running task
+ * @return uint8_t
+ */
+uint8_t task_get_priority(task_t task) {
+  return (task == NULL ? current_task : task)->priority;
+}
+
+/**
+ * @brief Park a task until task_resume, whatever it was doing. A delay or
+ * wait the task was in ends early after it is resumed, waits check their
+ * condition again. Can be called from ISRs
+ *
+ * @warning A running task parked from an ISR or with interrupts disabled
+ * stops at the next switch. The idle task is never parked
+ *
+ * @param task Task handle, NULL for the running task
+ */
+void task_suspend(task_t task) {
+  uint8_t sreg = critical_enter();
+  if (task == NULL) {
+    task = current_task;
+  }
+
+#if AVRTOS_USE_TT
+  if (task == tt_task) { // runs outside of the queues, before every task
+    critical_exit(sreg);
+    return;
+  }
+#endif
+  // The idle task is the one left ready when every other task waits
+  if (task == idle_task || task->state == TERMINATED ||
+      (task->state == SUSPENDED && task->channel == TASK_PARKED)) {
+    critical_exit(sreg);
+    return;
+  }
+
+  TRACE(TRACE_SUSPEND, task, TASK_PARKED);
+  task_queue_delete(task_queue_of(task), task);
+  task->state = SUSPENDED;
+  task->channel = TASK_PARKED;
+  task_queue_insert(&suspended_tasks, task);
+
+  if (task == current_task) {
+    if (sreg & _BV(SREG_I)) {
+      task_switch();
+      cli(); // task_switch returns with interrupts enabled
+    } else {
+#if !AVRTOS_COOPERATIVE
+      need_switch = true; // at the exit of ISR, or the next tick
+#endif
+    }
+  }
+  critical_exit(sreg);
+}
+
+/**
+ * @brief Resume a task parked by task_suspend. Can be called from ISRs
+ *
+ * @param task Task handle
+ */
+void task_resume(task_t task) {
+  uint8_t sreg = critical_enter();
+  if (task->state == SUSPENDED && task->channel == TASK_PARKED) {
+    TRACE(TRACE_WAKE, task, TASK_PARKED);
+    task_queue_delete(&suspended_tasks, task);
+    task->channel = NULL;
+    task_ready(task);
+    task_preempt(sreg);
+  }
+  critical_exit(sreg);
+}
+
+/**
+ * @brief Move a task to dead tasks and wake its joiners
+ *
+ * @warning Must be called inside a critical section
+ *
+ * @param task Task
+ */
+static void task_terminate(task_t task) {
+  task_queue_delete(task_queue_of(task), task);
+
+  task->state = TERMINATED;
+  task->channel = NULL;
+  if (!task_queue_insert(&dead_tasks, task)) {
+    task->joiners = 0xff; // never freed, rather than freed while in use
+  }
+  task_wake(task);
+}
+
+/**
+ * @brief End the task. Its resources are freed later by the idle task, once
+ * it is joined or detached. A task whose function returns ends the same way
+ *
+ * @warning This function does not return
+ */
+void task_exit(void) {
+  critical_enter();
+  task_terminate(current_task);
+  task_switch();
+}
+
+/**
+ * @brief End a task. Its resources are freed later by the idle task, once it
+ * is joined or detached. The running task can destroy itself
+ *
+ * @param task Task handle
+ */
+void task_destroy(task_t task) {
+  if (task == NULL) {
+    return;
+  }
+
+  if (task == current_task) {
+    task_exit();
+  }
+
+  uint8_t sreg = critical_enter();
+  if (task->state != TERMINATED) {
+    task_terminate(task);
+  }
+  task_preempt(sreg);
+  critical_exit(sreg);
+}
+
+/**
+ * @brief Wait until a task ends. An ended task is kept until it is joined, a
+ * successful join detaches it
+ *
+ * @warning The handle must not be used after a successful join or
+ * task_detach
+ *
+ * @param task Task handle
+ * @param timeout Time of block or MAX_DELAY for suspending
+ * @return true if the task ended
+ * @return false if timeout occurred, or task is NULL or the running task
+ */
+bool task_join(task_t task, uint16_t timeout) {
+  if (task == NULL || task == current_task) {
+    return false;
+  }
+
+  uint8_t sreg = critical_enter();
+  if (timeout != MAX_DELAY) {
+    current_task->wake_tick = global_tick_count + timeout / 10;
+  }
+  task->joiners++;
+
+  while (task->state != TERMINATED) {
+    if (timeout != MAX_DELAY) {
+      if (TICK_REACHED(current_task->wake_tick)) {
+        task->joiners--;
+        critical_exit(sreg);
+        return false;
+      }
+      task_block(task);
+    } else {
+      task_suspend_on(task);
+    }
+  }
+
+  task->joiners--;
+  task->detached = true;
+  critical_exit(sreg);
+  return true;
+}
+
+/**
+ * @brief Let the idle task free a task once it ends, without joining it
+ *
+ * @warning The handle must not be used after task_detach
+ *
+ * @param task Task handle, NULL for the running task
+ */
+void task_detach(task_t task) {
+  uint8_t sreg = critical_enter();
+  if (task == NULL) {
+    task = current_task;
+  }
+  task->detached = true;
+  critical_exit(sreg);
+}
+
+/**
+ * @brief Free the ended tasks which are detached and nobody is joining
+ *
+ */
+static void task_reclaim(void) {
+  uint8_t sreg = critical_enter();
+  uint8_t i = 0;
+  while (i < dead_tasks.length) {
+    task_t task = dead_tasks.tasks[i];
+    if (task->detached && task->joiners == 0) {
+      task_queue_delete(&dead_tasks, task);
+      task_free(task);
+      i = 0;
+    } else {
+      i++;
+    }
+  }
+  critical_exit(sreg);
+}
+
+#if AVRTOS_USE_SEMAPHORE
+/**
+ * @brief Create a semaphore
+ *
+ * @param count Initial count of semaphore
+ * @return semaphore_t
+ */
+semaphore_t semaphore_init(uint8_t count) {
+  semaphore_t sem = malloc(sizeof(*sem));
+  if (sem == NULL) {
+    goto sem_error;
+  }
+
+  void *channel = malloc(1);
+  if (channel == NULL) {
+    goto chan_error;
+  }
+
+  sem->count = count;
+  sem->channel = channel;
+
+  return sem;
+
+chan_error:
+  free(sem);
+sem_error:
+  return NULL;
+}
+
+/**
+ * @brief Wait to acquire semaphore. If timeout is MAX_DELAY suspend until
+ * acquire, else block to acquire until timeout expires
+ *
+ * @param sem Semaphore
+ * @param timeout Time of block or MAX_DELAY for suspending
+ * @return true
+ * @return false
+ */
+bool semaphore_take(semaphore_t sem, uint16_t timeout) {
+  uint8_t sreg = critical_enter();
+
+  if (timeout != MAX_DELAY) {
+    current_task->wake_tick = global_tick_count + timeout / 10;
+  }
+
+  while (sem->count == 0) {
+    if (timeout != MAX_DELAY) {
+      if (TICK_REACHED(current_task->wake_tick)) {
+        critical_exit(sreg);
+        return false;
+      }
+      task_block(sem->channel);
+    } else {
+      task_suspend_on(sem->channel);
+    }
+  }
+
+  sem->count--;
+  TRACE(TRACE_SEM_TAKE, current_task, sem);
+  critical_exit(sreg);
+  return true;
+}
+
+/**
+ * @brief Give back the semaphore
+ *
+ * @param sem Semaphore
+ */
+void semaphore_give(semaphore_t sem) {
+  uint8_t sreg = critical_enter();
+  sem->count++;
+  TRACE(TRACE_SEM_GIVE, current_task, sem);
+  task_wake(sem->channel);
+  task_preempt(sreg);
+  critical_exit(sreg);
+}
+
+/**
+ * @brief Deallocate the resources of semaphore
+ *
+ * @param sem Semaphore
+ */
+void semaphore_destroy(semaphore_t sem) {
+  uint8_t sreg = critical_enter();
+  task_wake(sem->channel);
+  if (sem != NULL) {
+    free(sem->channel);
+    free(sem);
+  }
+  task_preempt(sreg);
+  critical_exit(sreg);
+}
+#endif
+
+#if AVRTOS_USE_QUEUE
+/**
+ * @brief Create a FIFO queue
+ *
+ * @param capacity Capacity of queue
+ * @param item_size Size of items going to be stored in queue
+ * @return queue_t
+ */
+queue_t queue_init(uint8_t capacity, uint8_t item_size) {
+  queue_t queue = malloc(sizeof(*queue));
+  if (queue == NULL) {
+    goto queue_error;
+  }
+
+  queue->capacity = capacity;
+  queue->item_size = item_size;
+  queue->items = calloc(capacity, item_size);
+  queue->read_waiting = 0;
+  queue->write_waiting = 0;
+  queue->read_channel = malloc(1);
+  queue->write_channel = malloc(1);
+
+  if (queue->items == NULL) {
+    goto items_error;
+  }
+
+  return queue;
+
+items_error:
+  free(queue);
+queue_error:
+  return NULL;
+}
+
+/**
+ * @brief Copy an item to back of a queue which is not full and wake readers
+ *
+ * @warning Must be called inside a critical section
+ *
+ * @param queue Message queue
+ * @param item Message
+ */
+static void queue_push(queue_t queue, const void *item) {
+  memcpy(queue->items + queue->length * queue->item_size, item,
+         queue->item_size);
+  queue->length++;
+  TRACE(TRACE_QUEUE_SEND, current_task, queue);
+
+  if (queue->read_waiting) {
+    task_wake(queue->read_channel);
+  }
+}
+
+/**
+ * @brief Copy an item from front of a queue which is not empty and wake
+ * writers
+ *
+ * @warning Must be called inside a critical section
+ *
+ * @param queue Message queue
+ * @param item Message
+ */
+static void queue_pop(queue_t queue, void *item) {
+  queue->length--;
+  memcpy(item, queue->items, queue->item_size);
+  memmove(queue->items, queue->items + queue->item_size,
+          queue->item_size * queue->length);
+  memset(queue->items + queue->item_size * queue->length, 0, queue->item_size);
+  TRACE(TRACE_QUEUE_RECEIVE, current_task, queue);
+
+  if (queue->write_waiting) {
+    task_wake(queue->write_channel);
+  }
+}
+
+/**
+ * @brief Send to back of queue
+ *
+ * @param queue Message queue
+ * @param item Message
+ * @param timeout Timeout
+ * @returns bool
+ */
+bool queue_send(queue_t queue, void *item, uint16_t timeout) {
+  uint8_t sreg = critical_enter();
+  if (timeout != MAX_DELAY) {
+    current_task->wake_tick = global_tick_count + timeout / 10;
+  }
+  queue->write_waiting++;
+
+  while (queue->length == queue->capacity) {
+    if (timeout != MAX_DELAY) {
+      if (TICK_REACHED(current_task->wake_tick)) {
+        queue->write_waiting--;
+        critical_exit(sreg);
+        return false;
+      }
+      task_block(queue->write_channel);
+    } else {
+      task_suspend_on(queue->write_channel);
+    }
+  }
+
+  queue->write_waiting--;
+  queue_push(queue, item);
+
+  task_preempt(sreg);
+  critical_exit(sreg);
+  return true;
+}
+
+/**
+ * @brief Receive from front of the queue
+ *
+ * @param queue Message queue
+ * @param item Message
+ * @param timeout Timeout
+ * @return bool
+ */
+bool queue_receive(queue_t queue, void *item, uint16_t timeout) {
+  uint8_t sreg = critical_enter();
+  if (timeout != MAX_DELAY) {
+    current_task->wake_tick = global_tick_count + timeout / 10;
+  }
+  queue->read_waiting++;
+
+  while (queue->length == 0) {
+    if (timeout != MAX_DELAY) {
+      if (TICK_REACHED(current_task->wake_tick)) {
+        queue->read_waiting--;
+        critical_exit(sreg);
+        return false;
+      }
+      task_block(queue->read_channel);
+    } else {
+      task_suspend_on(queue->read_channel);
+    }
+  }
+
+  queue->read_waiting--;
+  queue_pop(queue, item);
+
+  task_preempt(sreg);
+  critical_exit(sreg);
+  return true;
+}
+
+/**
+ * @brief Deallocate queues resources
+ *
+ * @param queue Queue to deallocate
+ */
+void queue_destroy(queue_t queue) {
+  uint8_t sreg = critical_enter();
+  task_wake(queue->read_channel);
+  task_wake(queue->write_channel);
+
+  if (queue) {
+    free(queue->write_channel);
+    free(queue->read_channel);
+    free(queue->items);
+    free(queue);
+  }
+  task_preempt(sreg);
+  critical_exit(sreg);
+}
+#endif
+
+#if AVRTOS_USE_MAILBOX
+/**
+ * @brief Create a mailbox holding the latest written item
+ *
+ * @param item_size Size of the item stored in mailbox
+ * @return mailbox_t
+ */
+mailbox_t mailbox_init(uint8_t item_size) {
+  mailbox_t mbox = malloc(sizeof(*mbox));
+  if (mbox == NULL) {
+    goto mbox_error;
+  }
+
+  mbox->item = calloc(1, item_size);
+  if (mbox->item == NULL) {
+    goto item_error;
+  }
+
+  mbox->channel = malloc(1);
+  if (mbox->channel == NULL) {
+    goto chan_error;
+  }
+
+  mbox->sequence = 0;
+  mbox->item_size = item_size;
+  mbox->version = 0;
+  mbox->waiting = 0;
+
+  return mbox;
+
+chan_error:
+  free(mbox->item);
+item_error:
+  free(mbox);
+mbox_error:
+  return NULL;
+}
+
+/**
+ * @brief Overwrite the item in mailbox and wake the waiting tasks. Can be
+ * called from ISRs
+ *
+ * @param mbox Mailbox
+ * @param item Item to write
+ */
+void mailbox_write(mailbox_t mbox, const void *item) {
+  uint8_t sreg = critical_enter();
+
+  mbox->sequence++;
+  memcpy(mbox->item, item, mbox->item_size);
+  mbox->version++;
+  if (mbox->version == 0) {
+    mbox->version = 1;
+  }
+  mbox->sequence++;
+
+  if (mbox->waiting) {
+    task_wake(mbox->channel);
+  }
+
+  task_preempt(sreg);
+  critical_exit(sreg);
+}
+
+/**
+ * @brief Read the sequence counter of a mailbox, whose two bytes a write
+ * could otherwise change in between
+ *
+ * @param mbox Mailbox
+ * @return uint16_t
+ */
+static uint16_t mailbox_sequence(mailbox_t mbox) {
+  uint8_t sreg = critical_enter();
+  uint16_t sequence = mbox->sequence;
+  critical_exit(sreg);
+  return sequence;
+}
+
+/**
+ * @brief Copy the latest item without blocking. Interrupts are disabled only
+ * to read the sequence counter, the copy is retried if a write happens in the
+ * middle of it
+ *
+ * @param mbox Mailbox
+ * @param item Buffer to copy the item into
+ * @return uint16_t Version of the copied item, 0 if mailbox was never written
+ */
+uint16_t mailbox_read(mailbox_t mbox, void *item) {
+  uint16_t sequence;
+  uint16_t version;
+
+  do {
+    sequence = mailbox_sequence(mbox);
+    asm volatile("" ::: "memory");
+    memcpy(item, mbox->item, mbox->item_size);
+    version = mbox->version;
+    asm volatile("" ::: "memory");
+  } while ((sequence & 1) || sequence != mailbox_sequence(mbox));
+
+  return version;
+}
+
+/**
+ * @brief Wait until the mailbox holds a newer item than version
+ *
+ * @param mbox Mailbox
+ * @param version Version returned by the last mailbox_read
+ * @param timeout Time of block or MAX_DELAY for suspending
+ * @return true
+ * @return false
+ */
+bool mailbox_wait_newer(mailbox_t mbox, uint16_t version, uint16_t timeout) {
+  uint8_t sreg = critical_enter();
+  if (timeout != MAX_DELAY) {
+    current_task->wake_tick = global_tick_count + timeout / 10;
+  }
+  mbox->waiting++;
+
+  while (mbox->version == version) {
+    if (timeout != MAX_DELAY) {
+      if (TICK_REACHED(current_task->wake_tick)) {
+        mbox->waiting--;
+        critical_exit(sreg);
+        return false;
+      }
+      task_block(mbox->channel);
+    } else {
+      task_suspend_on(mbox->channel);
+    }
+  }
+
+  mbox->waiting--;
+  critical_exit(sreg);
+  return true;
+}
+
+/**
+ * @brief Deallocate the resources of mailbox
+ *
+ * @param mbox Mailbox
+ */
+void mailbox_destroy(mailbox_t mbox) {
+  uint8_t sreg = critical_enter();
+  if (mbox != NULL) {
+    task_wake(mbox->channel);
+    free(mbox->channel);
+    free(mbox->item);
+    free(mbox);
+  }
+  task_preempt(sreg);
+  critical_exit(sreg);
+}
+#endif
+
+#if AVRTOS_USE_TOPIC
+/**
+ * @brief Create a topic keeping the last capacity published messages for
+ * its subscribers
+ *
+ * @param capacity Number of messages kept
+ * @param item_size Size of messages
+ * @return topic_t, NULL if capacity is 0 or out of memory
+ */
+topic_t topic_init(uint8_t capacity, uint8_t item_size) {
+  if (capacity == 0) {
+    return NULL;
+  }
+
+  topic_t topic = malloc(sizeof(*topic));
+  if (topic == NULL) {
+    goto topic_error;
+  }
+
+  topic->items = calloc(capacity, item_size);
+  if (topic->items == NULL) {
+    goto items_error;
+  }
+
+  topic->channel = malloc(1);
+  if (topic->channel == NULL) {
+    goto chan_error;
+  }
+
+  topic->capacity = capacity;
+  topic->item_size = item_size;
+  topic->head = 0;
+  topic->published = 0;
+  topic->waiting = 0;
+
+  return topic;
+
+chan_error:
+  free(topic->items);
+items_error:
+  free(topic);
+topic_error:
+  return NULL;
+}
+
+/**
+ * @brief Subscribe to a topic. The subscriber receives the messages published
+ * after this call
+ *
+ * @param topic Topic
+ * @return subscriber_t
+ */
+subscriber_t topic_subscribe(topic_t topic) {
+  subscriber_t sub = malloc(sizeof(*sub));
+  if (sub == NULL) {
+    return NULL;
+  }
+
+  uint8_t sreg = critical_enter();
+  sub->topic = topic;
+  sub->cursor = topic->published;
+  sub->dropped = 0;
+  critical_exit(sreg);
+
+  return sub;
+}
+
+/**
+ * @brief Publish a message to every subscriber and wake the waiting ones. The
+ * message is copied once and the publisher never blocks, the oldest message
+ * is overwritten when the topic is full. Can be called from ISRs
+ *
+ * @param topic Topic
+ * @param item Message
+ */
+void topic_publish(topic_t topic, const void *item) {
+  uint8_t sreg = critical_enter();
+
+  memcpy(topic->items + topic->head * topic->item_size, item,
+         topic->item_size);
+  if (++topic->head == topic->capacity) {
+    topic->head = 0;
+  }
+  topic->published++;
+
+  if (topic->waiting) {
+    task_wake(topic->channel);
+  }
+
+  task_preempt(sreg);
+  critical_exit(sreg);
+}
+
+/**
+ * @brief Receive the next message of the subscriber. Messages overwritten
+ * before the subscriber read them are skipped and counted as dropped
+ *
+ * @param sub Subscriber
+ * @param item Buffer to copy the message into
+ * @param timeout Time of block or MAX_DELAY for suspending
+ * @return true
+ * @return false
+ */
+bool topic_receive(subscriber_t sub, void *item, uint16_t timeout) {
+  topic_t topic = sub->topic;
+
+  uint8_t sreg = critical_enter();
+  if (timeout != MAX_DELAY) {
+    current_task->wake_tick = global_tick_count + timeout / 10;
+  }
+  topic->waiting++;
+
+  while (sub->cursor == topic->published) {
+    if (timeout != MAX_DELAY) {
+      if (TICK_REACHED(current_task->wake_tick)) {
+        topic->waiting--;
+        critical_exit(sreg);
+        return false;
+      }
+      task_block(topic->channel);
+    } else {
+      task_suspend_on(topic->channel);
+    }
+  }
+  topic->waiting--;
+
+  uint16_t lag = topic->published - sub->cursor;
+  if (lag > topic->capacity) {
+    sub->dropped += lag - topic->capacity;
+    sub->cursor = topic->published - topic->capacity;
+    lag = topic->capacity;
+  }
+
+  // The counters wrap at 65536, the slot is found from the distance to head
+  uint8_t slot = topic->head >= lag ? topic->head - lag
+                                    : topic->head + topic->capacity - lag;
+  memcpy(item, topic->items + slot * topic->item_size, topic->item_size);
+  sub->cursor++;
+
+  critical_exit(sreg);
+  return true;
+}
+
+/**
+ * @brief Number of messages the subscriber missed because it fell behind
+ *
+ * @param sub Subscriber
+ * @return uint16_t
+ */
+uint16_t topic_dropped(subscriber_t sub) {
+  uint8_t sreg = critical_enter();
+  uint16_t dropped = sub->dropped;
+  critical_exit(sreg);
+  return dropped;
+}
+
+/**
+ * @brief Deallocate a subscriber
+ *
+ * @param sub Subscriber
+ */
+void topic_unsubscribe(subscriber_t sub) { free(sub); }
+
+/**
+ * @brief Deallocate the resources of topic. Its subscribers must be
+ * unsubscribed first
+ *
+ * @param topic Topic
+ */
+void topic_destroy(topic_t topic) {
+  uint8_t sreg = critical_enter();
+  if (topic != NULL) {
+    task_wake(topic->channel);
+    free(topic->channel);
+    free(topic->items);
+    free(topic);
+  }
+  task_preempt(sreg);
+  critical_exit(sreg);
+}
+#endif
+
+#if AVRTOS_USE_RWLOCK
+/**
+ * @brief Create a reader-writer lock. Readers share the lock, writers own it
+ * exclusively and are preferred over new readers
+ *
+ * @return rwlock_t
+ */
+rwlock_t rwlock_init(void) {
+  rwlock_t rwlock = malloc(sizeof(*rwlock));
+  if (rwlock == NULL) {
+    goto rwlock_error;
+  }
+
+  rwlock->read_channel = malloc(1);
+  if (rwlock->read_channel == NULL) {
+    goto read_error;
+  }
+
+  rwlock->write_channel = malloc(1);
+  if (rwlock->write_channel == NULL) {
+    goto write_error;
+  }
+
+  rwlock->readers = 0;
+  rwlock->writer = false;
+  rwlock->writers_waiting = 0;
+
+  return rwlock;
+
+write_error:
+  free(rwlock->read_channel);
+read_error:
+  free(rwlock);
+rwlock_error:
+  return NULL;
+}
+
+/**
+ * @brief Wait to acquire the lock for reading. New readers wait while a
+ * writer is waiting
+ *
+ * @param rwlock Reader-writer lock
+ * @param timeout Time of block or MAX_DELAY for suspending
+ * @return true
+ * @return false
+ */
+bool rwlock_read_lock(rwlock_t rwlock, uint16_t timeout) {
+  uint8_t sreg = critical_enter();
+
+  if (timeout != MAX_DELAY) {
+    current_task->wake_tick = global_tick_count + timeout / 10;
+  }
+
+  while (rwlock->writer || rwlock->writers_waiting) {
+    if (timeout != MAX_DELAY) {
+      if (TICK_REACHED(current_task->wake_tick)) {
+        critical_exit(sreg);
+        return false;
+      }
+      task_block(rwlock->read_channel);
+    } else {
+      task_suspend_on(rwlock->read_channel);
+    }
+  }
+
+  rwlock->readers++;
+  critical_exit(sreg);
+  return true;
+}
+
+/**
+ * @brief Release the lock acquired for reading
+ *
+ * @param rwlock Reader-writer lock
+ */
+void rwlock_read_unlock(rwlock_t rwlock) {
+  uint8_t sreg = critical_enter();
+  rwlock->readers--;
+  if (rwlock->readers == 0 && rwlock->writers_waiting) {
+    task_wake_one(rwlock->write_channel);
+  }
+  task_preempt(sreg);
+  critical_exit(sreg);
+}
+
+/**
+ * @brief Wait to acquire the lock for writing
+ *
+ * @param rwlock Reader-writer lock
+ * @param timeout Time of block or MAX_DELAY for suspending
+ * @return true
+ * @return false
+ */
+bool rwlock_write_lock(rwlock_t rwlock, uint16_t timeout) {
+  uint8_t sreg = critical_enter();
+
+  if (timeout != MAX_DELAY) {
+    current_task->wake_tick = global_tick_count + timeout / 10;
+  }
+  rwlock->writers_waiting++;
+
+  while (rwlock->writer || rwlock->readers) {
+    if (timeout != MAX_DELAY) {
+      if (TICK_REACHED(current_task->wake_tick)) {
+        rwlock->writers_waiting--;
+        if (rwlock->writers_waiting == 0 && !rwlock->writer) {
+          task_wake(rwlock->read_channel); // readers held back by this writer
+        }
+        task_preempt(sreg);
+        critical_exit(sreg);
+        return false;
+      }
+      task_block(rwlock->write_channel);
+    } else {
+      task_suspend_on(rwlock->write_channel);
+    }
+  }
+
+  rwlock->writers_waiting--;
+  rwlock->writer = true;
+  critical_exit(sreg);
+  return true;
+}
+
+/**
+ * @brief Release the lock acquired for writing. The next writer is preferred,
+ * else all the waiting readers are woken at once
+ *
+ * @param rwlock Reader-writer lock
+ */
+void rwlock_write_unlock(rwlock_t rwlock) {
+  uint8_t sreg = critical_enter();
+  rwlock->writer = false;
+  if (rwlock->writers_waiting) {
+    task_wake_one(rwlock->write_channel);
+  } else {
+    task_wake(rwlock->read_channel);
+  }
+  task_preempt(sreg);
+  critical_exit(sreg);
+}
+
+/**
+ * @brief Deallocate the resources of reader-writer lock
+ *
+ * @param rwlock Reader-writer lock
+ */
+void rwlock_destroy(rwlock_t rwlock) {
+  uint8_t sreg = critical_enter();
+  if (rwlock != NULL) {
+    task_wake(rwlock->read_channel);
+    task_wake(rwlock->write_channel);
+    free(rwlock->read_channel);
+    free(rwlock->write_channel);
+    free(rwlock);
+  }
+  task_preempt(sreg);
+  critical_exit(sreg);
+}
+#endif
+
+#if AVRTOS_USE_COND
+/**
+ * @brief Create a condition variable
+ *
+ * @return cond_t
+ */
+cond_t cond_init(void) {
+  cond_t cond = malloc(sizeof(*cond));
+  if (cond == NULL) {
+    goto cond_error;
+  }
+
+  cond->channel = malloc(1);
+  if (cond->channel == NULL) {
+    goto chan_error;
+  }
+
+  return cond;
+
+chan_error:
+  free(cond);
+cond_error:
+  return NULL;
+}
+
+/**
+ * @brief Release the lock and wait for a signal in one step, then acquire the
+ * lock again. The lock is held on return even if the wait timed out
+ *
+ * @param cond Condition variable
+ * @param lock Semaphore used as mutex, held by the caller
+ * @param timeout Time of block or MAX_DELAY for suspending
+ * @return true Signalled
+ * @return false Timed out
+ */
+bool cond_wait(cond_t cond, semaphore_t lock, uint16_t timeout) {
+  uint8_t sreg = critical_enter();
+
+  semaphore_give(lock);
+  if (timeout != MAX_DELAY) {
+    current_task->wake_tick = global_tick_count + timeout / 10;
+    task_block(cond->channel);
+  } else {
+    task_suspend_on(cond->channel);
+  }
+
+  // Waking clears the channel, expired tasks keep it
+  bool signalled = (current_task->channel == NULL);
+  current_task->channel = NULL;
+  critical_exit(sreg);
+
+  semaphore_take(lock, MAX_DELAY);
+  return signalled;
+}
+
+/**
+ * @brief Wake the highest priority waiting task
+ *
+ * @param cond Condition variable
+ */
+void cond_signal(cond_t cond) {
+  uint8_t sreg = critical_enter();
+  task_wake_one(cond->channel);
+  task_preempt(sreg);
+  critical_exit(sreg);
+}
+
+/**
+ * @brief Wake all the waiting tasks, they run in priority order
+ *
+ * @param cond Condition variable
+ */
+void cond_broadcast(cond_t cond) {
+  uint8_t sreg = critical_enter();
+  task_wake(cond->channel);
+  task_preempt(sreg);
+  critical_exit(sreg);
+}
+
+/**
+ * @brief Deallocate the resources of condition variable
+ *
+ * @param cond Condition variable
+ */
+void cond_destroy(cond_t cond) {
+  uint8_t sreg = critical_enter();
+  if (cond != NULL) {
+    task_wake(cond->channel);
+    free(cond->channel);
+    free(cond);
+  }
+  task_preempt(sreg);
+  critical_exit(sreg);
+}
+#endif
+
+#if AVRTOS_USE_WORK
+/**
+ * @brief Worker task function. Only the worker advances the tail, so items
+ * are taken without disabling interrupts
+ *
+ * @param arg
+ */
+static void work_task_fn(void *arg) {
+  (void)arg;
+  for (;;) {
+    uint8_t sreg = critical_enter();
+    while (work_head == work_tail) {
+      work_waiting = true;
+      task_suspend_on(work_queue);
+    }
+    critical_exit(sreg);
+
+    work_item_t item = work_queue[work_tail & (AVRTOS_WORK_QUEUE_SIZE - 1)];
+    work_tail++;
+    item.fn(item.arg);
+  }
+}
+
+/**
+ * @brief Create the worker task which runs the submitted work items in order
+ *
+ * @param priority Priority of the worker task, usually the highest one
+ * @param stack_size Size of the worker tasks stack
+ * @return true
+ * @return false if the worker already exists or out of memory
+ */
+bool work_init(uint8_t priority, size_t stack_size) {
+  if (work_task != NULL) {
+    return false;
+  }
+
+  work_task = task_init(work_task_fn, NULL, "worker", stack_size, priority);
+  return work_task != NULL;
+}
+
+/**
+ * @brief Queue a function to run in the worker task with interrupts enabled.
+ * Can be called from ISRs
+ *
+ * @param fn Function to run
+ * @param arg Argument passed to function
+ * @return true
+ * @return false Queue is full, the item is dropped
+ */
+bool work_submit(void (*fn)(void *), void *arg) {
+  uint8_t sreg = critical_enter();
+
+  uint8_t depth = work_head - work_tail;
+  if (depth == AVRTOS_WORK_QUEUE_SIZE) {
+    work_drops++;
+    critical_exit(sreg);
+    return false;
+  }
+
+  work_item_t *item = &work_queue[work_head & (AVRTOS_WORK_QUEUE_SIZE - 1)];
+  item->fn = fn;
+  item->arg = arg;
+  work_head++;
+
+  if (depth + 1 > work_high_water) {
+    work_high_water = depth + 1;
+  }
+
+  if (work_waiting) {
+    work_waiting = false;
+    task_wake(work_queue);
+  }
+
+  task_preempt(sreg);
+  critical_exit(sreg);
+  return true;
+}
+
+/**
+ * @brief Get the statistics of the work queue
+ *
+ * @param stats Statistics to fill
+ */
+void work_stats(work_stats_t *stats) {
+  uint8_t sreg = critical_enter();
+  stats->depth = work_head - work_tail;
+  stats->high_water = work_high_water;
+  stats->drops = work_drops;
+  critical_exit(sreg);
+}
+#endif
+
+#if AVRTOS_USE_CORO
+/**
+ * @brief Coroutine runner task function. Runs the highest priority ready
+ * coroutine one step at a time and waits out of all queues while none is
+ * ready
+ *
+ * @param arg
+ */
+static void coro_runner_fn(void *arg) {
+  (void)arg;
+  for (;;) {
+    uint8_t sreg = critical_enter();
+    coro_t coro = (coro_t)task_queue_top(&coro_ready);
+    if (coro == NULL) {
+      coro_runner->state = SUSPENDED;
+      task_queue_delete(&ready_tasks, coro_runner);
+      task_switch();
+      cli(); // task_switch returns with interrupts enabled
+      critical_exit(sreg);
+      continue;
+    }
+    task_queue_delete(&coro_ready, &coro->task);
+    coro->task.state = RUNNING;
+    critical_exit(sreg);
+
+    coro_status status = coro->fn(coro, coro->arg);
+
+    sreg = critical_enter();
+    if (status == CORO_READY) {
+      task_ready(&coro->task);
+    } else if (status == CORO_ENDED) {
+      free(coro);
+    }
+    coro_runner_update();
+
+    // Give way to a task which became ready during the step
+    if (task_queue_top(&ready_tasks) != coro_runner) {
+      coro_runner->state = READY;
+      task_switch();
+      cli(); // task_switch returns with interrupts enabled
+    }
+    critical_exit(sreg);
+  }
+}
+
+/**
+ * @brief Create a stackless coroutine. All coroutines are run by one task on
+ * a stack of AVRTOS_CORO_STACK_SIZE bytes, with the priority of the highest
+ * priority ready coroutine. A coroutine function is written between
+ * CORO_BEGIN and CORO_END and is called again from where it stopped after
+ * every wait
+ *
+ * @warning Local variables do not keep their values across CORO_* waits, keep
+ * the state in arg or in static variables
+ *
+ * @param fn Function of coroutine
+ * @param arg Argument passed to function
+ * @param priority Priority of coroutine
+ * @return coro_t
+ */
+coro_t coro_init(coro_status (*fn)(coro_t coro, void *arg), void *arg,
+                 uint8_t priority) {
+  coro_t coro = malloc(sizeof(*coro));
+  if (coro == NULL) {
+    goto coro_error;
+  }
+
+  coro->task.stack = NULL;
+  coro->task.stack_top = NULL;
+  coro->task.priority = priority;
+  coro->task.channel = NULL;
+  coro->task.joiners = 0;
+  coro->task.detached = false;
+#if AVRTOS_USE_TRACE
+  coro->task.id = trace_next_id++;
+#endif
+#if AVRTOS_SCHED_EDF
+  coro->task.relative_deadline = 0;
+  coro->task.deadline_misses = 0;
+#endif
+#if AVRTOS_TASK_NAME_LENGTH > 0
+  coro->task.name[0] = '\0';
+#endif
+  coro->fn = fn;
+  coro->arg = arg;
+  coro->lc = 0;
+  coro->timed = false;
+  coro->waiting = false;
+
+  uint8_t sreg = critical_enter();
+  if (coro_runner == NULL) {
+    coro_runner = task_create(coro_runner_fn, NULL, "coro runner",
+                              AVRTOS_CORO_STACK_SIZE, priority);
+    if (coro_runner == NULL) {
+      critical_exit(sreg);
+      goto runner_error;
+    }
+    coro_runner->state = SUSPENDED;
+  }
+  task_ready(&coro->task);
+  critical_exit(sreg);
+
+  return coro;
+
+runner_error:
+  free(coro);
+coro_error:
+  return NULL;
+}
+
+/**
+ * @brief Line the coroutine continues from, used by CORO_* macros
+ *
+ * @param coro Coroutine
+ * @return uint16_t*
+ */
+uint16_t *coro_lc(coro_t coro) { return &coro->lc; }
+
+/**
+ * @brief Make the coroutine wait for specified milliseconds after it returns
+ * CORO_WAITING, used by CORO_DELAY
+ *
+ * @param coro Coroutine
+ * @param ms Milliseconds to delay
+ */
+void coro_delay(coro_t coro, uint16_t ms) {
+  uint8_t sreg = critical_enter();
+  coro->task.wake_tick = global_tick_count + ms / 10;
+  coro->task.state = BLOCKED;
+  coro->task.channel = NULL; // left set by a wait that timed out
+  task_queue_insert(&blocked_tasks, &coro->task);
+  critical_exit(sreg);
+}
+
+/**
+ * @brief Start the timeout of a wait, used by CORO_* macros
+ *
+ * @param coro Coroutine
+ * @param timeout Time of block or MAX_DELAY for suspending
+ */
+void coro_wait_start(coro_t coro, uint16_t timeout) {
+  coro->timed = timeout != MAX_DELAY;
+  if (coro->timed) {
+    uint8_t sreg = critical_enter();
+    coro->task.wake_tick = global_tick_count + timeout / 10;
+    critical_exit(sreg);
+  }
+}
+
+/**
+ * @brief Check the timeout of the coroutine or put it to wait on channel
+ *
+ * @warning Must be called inside a critical section
+ *
+ * @param coro Coroutine
+ * @param chan Channel to wait on
+ * @return int8_t 0 if timed out, -1 if waiting
+ */
+static int8_t coro_wait(coro_t coro, void *chan) {
+  if (coro->timed) {
+    if (TICK_REACHED(coro->task.wake_tick)) {
+      return 0;
+    }
+    TRACE(TRACE_BLOCK, &coro->task, chan);
+    coro->task.state = BLOCKED;
+    coro->task.channel = chan;
+    task_queue_insert(&blocked_tasks, &coro->task);
+  } else {
+    TRACE(TRACE_SUSPEND, &coro->task, chan);
+    coro->task.state = SUSPENDED;
+    coro->task.channel = chan;
+    task_queue_insert(&suspended_tasks, &coro->task);
+  }
+  return -1;
+}
+
+#if AVRTOS_USE_SEMAPHORE
+/**
+ * @brief Try to acquire semaphore, used by CORO_SEMAPHORE_TAKE
+ *
+ * @param coro Coroutine
+ * @param sem Semaphore
+ * @return int8_t 1 if acquired, 0 if timed out, -1 if coroutine must return
+ * CORO_WAITING
+ */
+int8_t coro_semaphore_take(coro_t coro, semaphore_t sem) {
+  uint8_t sreg = critical_enter();
+  int8_t result = 1;
+  if (sem->count == 0) {
+    result = coro_wait(coro, sem->channel);
+  } else {
+    sem->count--;
+    TRACE(TRACE_SEM_TAKE, &coro->task, sem);
+  }
+  critical_exit(sreg);
+  return result;
+}
+#endif
+
+#if AVRTOS_USE_QUEUE
+/**
+ * @brief Try to send to back of queue, used by CORO_QUEUE_SEND
+ *
+ * @param coro Coroutine
+ * @param queue Message queue
+ * @param item Message
+ * @return int8_t 1 if sent, 0 if timed out, -1 if coroutine must return
+ * CORO_WAITING
+ */
+int8_t coro_queue_send(coro_t coro, queue_t queue, const void *item) {
+  uint8_t sreg = critical_enter();
+  if (!coro->waiting) {
+    coro->waiting = true;
+    queue->write_waiting++;
+  }
+
+  int8_t result = 1;
+  if (queue->length == queue->capacity) {
+    result = coro_wait(coro, queue->write_channel);
+  }
+
+  if (result >= 0) {
+    coro->waiting = false;
+    queue->write_waiting--;
+  }
+  if (result > 0) {
+    queue_push(queue, item);
+  }
+  critical_exit(sreg);
+  return result;
+}
+
+/**
+ * @brief Try to receive from front of queue, used by CORO_QUEUE_RECEIVE
+ *
+ * @param coro Coroutine
+ * @param queue Message queue
+ * @param item Message
+ * @return int8_t 1 if received, 0 if timed out, -1 if coroutine must return
+ * CORO_WAITING
+ */
+int8_t coro_queue_receive(coro_t coro, queue_t queue, void *item) {
+  uint8_t sreg = critical_enter();
+  if (!coro->waiting) {
+    coro->waiting = true;
+    queue->read_waiting++;
+  }
+
+  int8_t result = 1;
+  if (queue->length == 0) {
+    result = coro_wait(coro, queue->read_channel);
+  }
+
+  if (result >= 0) {
+    coro->waiting = false;
+    queue->read_waiting--;
+  }
+  if (result > 0) {
+    queue_pop(queue, item);
+  }
+  critical_exit(sreg);
+  return result;
+}
+#endif
+#endif
+
+/**
+ * @brief Wake up expired tasks
+ *
+ */
+static void wake_expired_tasks(void) {
+  uint8_t i = 0;
+  while (i < blocked_tasks.length) {
+    task_t task = blocked_tasks.tasks[i];
+    if (TICK_REACHED(task->wake_tick)) {
+      task_queue_delete(&blocked_tasks, task);
+      task_ready(task);
+      i = 0;
+    } else {
+      i++;
+    }
+  }
+}
+
+#if AVRTOS_USE_TT
+/**
+ * @brief Run the slots of the released minor frame, wake the tasks whose
+ * delay expired at its tick, then wait for the next release. The whole table
+ * is scanned so every frame costs the same
+ *
+ * @param arg Unused
+ */
+static void tt_task_fn(void *arg) {
+  (void)arg;
+
+  for (;;) {
+    uint8_t frame = tt_frame;
+    for (uint8_t i = 0; i < tt_slot_count; i++) {
+      if (pgm_read_byte(&tt_table[i].frame) == frame) {
+        void (*fn)(void) =
+            (void (*)(void))(uintptr_t)pgm_read_word(&tt_table[i].fn);
+        fn();
+      }
+    }
+
+    uint8_t sreg = critical_enter();
+    wake_expired_tasks();
+    tt_task->state = SUSPENDED;
+    task_switch();
+    cli(); // task_switch returns with interrupts enabled
+    critical_exit(sreg);
+  }
+}
+
+/**
+ * @brief Advance the minor frame and release it. A frame released while the
+ * previous one is still running is skipped and counted as an overrun
+ *
+ * @return true if the frame was released
+ */
+static bool tt_tick(void) {
+  if (tt_task == NULL) {
+    return false;
+  }
+
+  if (++tt_frame == tt_frames) {
+    tt_frame = 0;
+  }
+  if (tt_task->state != SUSPENDED) {
+    tt_overrun_count++;
+    return false;
+  }
+  tt_task->state = READY;
+  return true;
+}
+
+/**
+ * @brief Start the time-triggered schedule. Every tick is a minor frame and
+ * runs the slots of the table with that frame, before any other task. Tasks
+ * run by priority in the time the slots leave
+ *
+ * @warning Slot functions must not delay, wait, end or destroy tasks.
+ * task_suspend(NULL) and task_set_priority(NULL, ...) do nothing in a slot or
+ * an ISR interrupting one
+ *
+ * @param table Slots in flash, declared with PROGMEM
+ * @param slot_count Number of slots in the table
+ * @param frames Minor frames in the major cycle
+ * @param stack_size Size of the stack the slots run on
+ * @return true if the schedule was started, false if one already runs or out
+ * of memory
+ */
+bool tt_init(const tt_slot_t *table, uint8_t slot_count, uint8_t frames,
+             size_t stack_size) {
+  if (tt_task != NULL || frames == 0) {
+    return false;
+  }
+
+  task_t task = task_create(tt_task_fn, NULL, "tt", stack_size, 0xff);
+  if (task == NULL) {
+    return false;
+  }
+  task->state = SUSPENDED;
+
+  uint8_t sreg = critical_enter();
+  tt_table = table;
+  tt_slot_count = slot_count;
+  tt_frames = frames;
+  tt_frame = frames - 1; // the first tick releases frame 0
+  tt_task = task;
+  critical_exit(sreg);
+
+  return true;
+}
+
+/**
+ * @brief Number of minor frames skipped because the previous frame overran
+ *
+ * @return uint16_t
+ */
+uint16_t tt_overruns(void) {
+  uint8_t sreg = critical_enter();
+  uint16_t overruns = tt_overrun_count;
+  critical_exit(sreg);
+  return overruns;
+}
+#endif
+
+/**
+ * @brief Advance time and wake the tasks whose delay or timeout expired. A
+ * released time-triggered frame wakes them after its slots instead, so the
+ * slots start at the same point of every tick
+ *
+ */
+static void scheduler_tick(void) {
+  global_tick_count++;
+#if AVRTOS_USE_TIME
+  if (global_tick_count % 100 == 0) {
+    system_tick();
+  }
+#endif
+
+#if AVRTOS_USE_STATS
+  if (current_task == idle_task) {
+    idle_ticks++;
+  }
+#endif
+
+#if AVRTOS_USE_TT
+  if (tt_tick()) {
+    return;
+  }
+#endif
+  wake_expired_tasks();
+}
+
+#if AVRTOS_COOPERATIVE
+/**
+ * @brief Timer interrupt ISR. Tasks are never switched by the tick, the woken
+ * ones run when the running task waits or yields
+ *
+ */
+KERNEL_ISR(TIMER1_COMPA_vect) { scheduler_tick(); }
+#else
+/**
+ * @brief Advance the tick and switch to the highest ready task, unless the
+ * scheduler is locked. Runs on the system stack inside the timer ISR
+ *
+ */
+static void scheduler_tick_switch(void) __attribute__((used));
+static void scheduler_tick_switch(void) {
+  scheduler_tick();
+
+  task_t previous_task = current_task;
+  if (scheduler_locks > 0) {
+    switch_pending = true;
+  } else {
+    need_switch = false;
+    if (current_task->state == RUNNING) {
+      current_task->state = READY;
+      // A released frame preempts the task, which keeps its place
+      if (!TT_RELEASED() && task_queue_delete(&ready_tasks, current_task)) {
+        task_queue_insert(&ready_tasks, current_task);
+      }
+    }
+
+    current_task = scheduler_next();
+    current_task->state = RUNNING;
+
+    if (current_task != previous_task) {
+#if AVRTOS_USE_STATS
+      context_switches++;
+#endif
+      TRACE(TRACE_SWITCH, current_task, previous_task);
+    }
+  }
+}
+
+/**
+ * @brief Timer interrupt ISR
+ *
+ */
+ISR(TIMER1_COMPA_vect, ISR_NAKED) {
+  SAVE_CONTEXT();
+  ENTER_SYSTEM_STACK();
+  asm volatile("call scheduler_tick_switch");
+  RESTORE_CONTEXT();
+  asm volatile("reti");
+}
+#endif
+
+/**
+ * @brief Set the timer interrupt object
+ *
+ */
+static void set_timer_interrupt(void) {
+  TCCR1B = (1 << CS11) | (1 << WGM12);
+  OCR1A = F_CPU / 8 / 100 - 1; // 10ms, 0.5us per count at 16 MHz
+  TIMSK1 = (1 << OCIE1A);
+}
+
+/**
+ * @brief Idle task function
+ *
+ * @param arg
+ */
+static void idle_task_fn(void *arg) {
+  (void)arg;
+  for (;;) {
+    task_reclaim();
+#if AVRTOS_COOPERATIVE
+    task_yield();
+#endif
+  }
+}
+
+/**
+ * @brief Start scheduler
+ *
+ * @warning If initialization is successful this function does not return
+ */
+void scheduler_init(void) {
+  idle_task = task_init(idle_task_fn, NULL, "idle task", 96, 0);
+  if (idle_task == NULL) {
+    return;
+  }
+
+  memset(system_stack, SYSTEM_STACK_PAINT, sizeof(system_stack));
+
+  // Start the first task from its own stack, the stack of main is not used
+  // anymore
+  cli();
+  current_task = scheduler_next();
+  current_task->state = RUNNING;
+  set_timer_interrupt();
+
+  RESTORE_CONTEXT();
+  asm volatile("reti");
+}
+
+/**
+ * @brief Stop switching tasks until the matching scheduler_unlock. Interrupts
+ * stay enabled and the tick keeps time and wakes tasks. Calls nest
+ *
+ * @warning The task must not delay or wait while the scheduler is locked
+ */
+void scheduler_lock(void) {
+  uint8_t sreg = critical_enter();
+  scheduler_locks++;
+  if (need_switch) {
+    // An ISR must not switch away from the locked task
+    need_switch = false;
+    switch_pending = true;
+  }
+  critical_exit(sreg);
+}
+
+/**
+ * @brief Undo one scheduler_lock. The last unlock does the switch a tick
+ * postponed, if a higher or equal priority task is ready
+ *
+ */
+void scheduler_unlock(void) {
+  uint8_t sreg = critical_enter();
+  if (scheduler_locks > 0 && --scheduler_locks == 0 && switch_pending) {
+    switch_pending = false;
+    if (current_task->state == RUNNING) {
+      if (task_queue_delete(&ready_tasks, current_task)) {
+        task_queue_insert(&ready_tasks, current_task);
+      }
+    }
+    if (scheduler_next() != current_task) {
+      task_switch();
+      cli(); // task_switch returns with interrupts enabled
+    }
+  }
+  critical_exit(sreg);
+}
+
+/**
+ * @brief Most bytes of the system stack used since the start of scheduler
+ *
+ * @return uint16_t
+ */
+uint16_t system_stack_high_water(void) {
+  uint16_t unused = 0;
+  while (unused < AVRTOS_SYSTEM_STACK_SIZE &&
+         system_stack[unused] == SYSTEM_STACK_PAINT) {
+    unused++;
+  }
+  return AVRTOS_SYSTEM_STACK_SIZE - unused;
+}
+
+#if AVRTOS_USE_STATS
+/**
+ * @brief Get the scheduler statistics
+ *
+ * @param stats Statistics to fill
+ */
+void scheduler_stats(scheduler_stats_t *stats) {
+  uint8_t sreg = critical_enter();
+  stats->ticks = global_tick_count;
+  stats->idle_ticks = idle_ticks;
+  stats->context_switches = context_switches;
+  critical_exit(sreg);
+}
+#endif
+
+#if AVRTOS_USE_UART
+/**
+ * @brief Write a character in stream
+ *
+ * @param c Character to write
+ * @param stream Stream to write
+ * @return int
+ */
+static int uart_putchar(char c, FILE *stream) {
+  if (c == '\n') {
+    uart_putchar('\r', stream);
+  }
+  loop_until_bit_is_set(UCSR0A, UDRE0);
+  UDR0 = c;
+  return 0;
+}
+
+/**
+ * @brief Read a character from stream
+ *
+ * @param stream Stream to read
+ * @return int
+ */
+static int uart_getchar(FILE *stream) {
+  (void)stream;
+  loop_until_bit_is_set(UCSR0A, RXC0);
+  return UDR0;
+}
+
+static FILE uart_output =
+    FDEV_SETUP_STREAM(uart_putchar, NULL, _FDEV_SETUP_WRITE);
+static FILE uart_input =
+    FDEV_SETUP_STREAM(NULL, uart_getchar, _FDEV_SETUP_READ);
+
+/**
+ * @brief Initialize the UART driver
+ *
+ */
+void uart_init(void) {
+  uart_sem = semaphore_init(1); // error handle
+
+  UBRR0H = UBRRH_VALUE;
+  UBRR0L = UBRRL_VALUE;
+
+  UCSR0B = _BV(RXEN0) | _BV(TXEN0);
+  UCSR0C = _BV(UCSZ01) | _BV(UCSZ00);
+
+  stdout = &uart_output;
+  stdin = &uart_input;
+}
+#endif
+
+#if AVRTOS_USE_GPIO
+/**
+ * @brief Set pin mode
+ *
+ * @param pin
+ * @param mode
+ */
+void gpio_set_pin_mode(uint8_t pin, gpio_pin_mode mode) {
+  uint8_t direction = (mode == OUTPUT);
+  uint8_t pin_value = (mode == INPUT_PULLUP);
+
+  if (pin < 8) {
+    PORTD |= (pin_value << pin);
+    DDRD |= (direction << pin);
+  } else if (pin < 14) {
+    PORTB |= (pin_value << (pin - 8));
+    DDRB |= (direction << (pin - 8));
+  } else if (pin <= A5) {
+    PORTC |= (pin_value << (pin - 14));
+    DDRC |= (direction << (pin - 14));
+  }
+}
+
+/**
+ * @brief Write low or high to a pin
+ *
+ * @param pin
+ * @param value
+ */
+void gpio_pin_write(uint8_t pin, uint8_t value) {
+  uint8_t sreg = critical_enter();
+  gpio_pin_write_fast(pin, value);
+  critical_exit(sreg);
+}
+
+/**
+ * @brief Read the pin
+ *
+ * @param pin
+ * @return uint8_t HIGH or LOW
+ */
+uint8_t gpio_pin_read(uint8_t pin) { return gpio_pin_read_fast(pin); }
+#endif
+
+#if AVRTOS_USE_UART
+int print(const char *fmt, ...) {
+  semaphore_take(uart_sem, MAX_DELAY);
+  va_list args;
+  va_start(args, fmt);
+
+  int bytes = vprintf(fmt, args);
+
+  va_end(args);
+  semaphore_give(uart_sem);
+  return bytes;
+}
+#endif
+
+#if AVRTOS_USE_TRACE
+/**
+ * @brief Start recording. In stream mode the UART must not be used by print
+ *
+ * @param mode Trace mode
+ */
+void trace_start(trace_mode mode) {
+  uint8_t sreg = critical_enter();
+  trace_head = 0;
+  trace_length = 0;
+  trace_byte = 0;
+  trace_dropped = 0;
+  trace_current_mode = mode;
+  trace_last_tick = global_tick_count - 1; // Start with a tick record
+  trace_enabled = true;
+  critical_exit(sreg);
+}
+
+/**
+ * @brief Stop recording
+ *
+ */
+void trace_stop(void) {
+  uint8_t sreg = critical_enter();
+  trace_enabled = false;
+  critical_exit(sreg);
+}
+
+/**
+ * @brief Stop recording and send the recorded records over UART
+ *
+ */
+void trace_dump(void) {
+  trace_stop();
+
+  uint8_t tail = (trace_head - trace_length) & (AVRTOS_TRACE_BUFFER_SIZE - 1);
+  for (uint8_t i = 0; i < trace_length; i++) {
+    const uint8_t *bytes =
+        (const uint8_t *)&trace_buffer[(tail + i) &
+                                       (AVRTOS_TRACE_BUFFER_SIZE - 1)];
+    loop_until_bit_is_set(UCSR0A, UDRE0);
+    UDR0 = 0xa5;
+    for (uint8_t j = 0; j < sizeof(trace_record_t); j++) {
+      loop_until_bit_is_set(UCSR0A, UDRE0);
+      UDR0 = bytes[j];
+    }
+  }
+  trace_length = 0;
+}
+
+/**
+ * @brief Record an event of the application, e.g. an ISR firing. Can be called
+ * from ISRs
+ *
+ * @param id Id of the event
+ * @param value Value of the event
+ */
+void trace_user(uint8_t id, uint16_t value) {
+  trace_record(TRACE_USER, id, value);
+}
+
+/**
+ * @brief Number of records dropped because the stream could not keep up
+ *
+ * @return uint16_t
+ */
+uint16_t trace_drops(void) {
+  uint8_t sreg = critical_enter();
+  uint16_t drops = trace_dropped;
+  critical_exit(sreg);
+  return drops;
+}
+
+/**
+ * @brief Send the next byte of the oldest record in stream mode
+ *
+ */
+KERNEL_ISR(USART_UDRE_vect) {
+  if (trace_length == 0) {
+    UCSR0B &= ~_BV(UDRIE0);
+    return;
+  }
+
+  uint8_t tail = (trace_head - trace_length) & (AVRTOS_TRACE_BUFFER_SIZE - 1);
+  if (trace_byte == 0) {
+    UDR0 = 0xa5;
+  } else {
+    UDR0 = ((const uint8_t *)&trace_buffer[tail])[trace_byte - 1];
+  }
+
+  trace_byte++;
+  if (trace_byte > sizeof(trace_record_t)) {
+    trace_byte = 0;
+    trace_length--;
+  }
+}
+#endif
+
+#if AVRTOS_USE_ADC
+/**
+ * @brief Initialize the ADC driver
+ *
+ * @param reference Voltage reference of conversions
+ */
+void adc_init(adc_reference reference) {
+  adc_sem = semaphore_init(1); // error handle
+
+  switch (reference) {
+  case ADC_REF_AREF:
+    adc_reference_bits = 0;
+    break;
+  case ADC_REF_AVCC:
+    adc_reference_bits = _BV(REFS0);
+    break;
+  case ADC_REF_INTERNAL:
+    adc_reference_bits = _BV(REFS1) | _BV(REFS0);
+    break;
+  }
+
+#if defined(PRR0)
+  PRR0 &= ~_BV(PRADC); // ATmega2560 splits power reduction into PRR0/PRR1
+#else
+  PRR &= ~_BV(PRADC);
+#endif
+  ADMUX = adc_reference_bits;
+  ADCSRA = _BV(ADEN) | ADC_PRESCALER;
+}
+
+/**
+ * @brief Convert an analog pin once. The task blocks until the conversion
+ * completes
+ *
+ * @param pin One of A0 - A5
+ * @param value Result of conversion
+ * @param timeout Time of block or MAX_DELAY for suspending
+ * @return true
+ * @return false if timeout occurred, the pin is invalid or a scan is running
+ */
+bool adc_read(uint8_t pin, uint16_t *value, uint16_t timeout) {
+  if (pin < A0 || pin > A5 || adc_scan.running) {
+    return false;
+  }
+
+  uint8_t sreg = critical_enter();
+  tick_t deadline = global_tick_count + timeout / 10;
+  critical_exit(sreg);
+
+  if (!semaphore_take(adc_sem, timeout)) {
+    return false;
+  }
+
+  sreg = critical_enter();
+  if (timeout != MAX_DELAY) {
+    current_task->wake_tick = deadline; // waiting for the ADC counts too
+  }
+
+  adc_done = false;
+  ADMUX = adc_reference_bits | (pin - A0);
+  ADCSRA = _BV(ADEN) | _BV(ADSC) | _BV(ADIE) | ADC_PRESCALER;
+
+  while (!adc_done) {
+    if (timeout != MAX_DELAY) {
+      if (TICK_REACHED(current_task->wake_tick)) {
+        ADCSRA &= ~_BV(ADIE);
+        loop_until_bit_is_clear(ADCSRA, ADSC);
+        ADCSRA |= _BV(ADIF);
+        critical_exit(sreg);
+        semaphore_give(adc_sem);
+        return false;
+      }
+      task_block((void *)&adc_value);
+    } else {
+      task_suspend_on((void *)&adc_value);
+    }
+  }
+
+  *value = adc_value;
+  critical_exit(sreg);
+  semaphore_give(adc_sem);
+  return true;
+}
+
+/**
+ * @brief Start converting the pins in turn into a ring buffer of blocks.
+ * Single conversions fail until the scan is stopped
+ *
+ * @param pins Pins to scan, A0 - A5
+ * @param pin_count Number of pins
+ * @param trigger Trigger source of conversions
+ * @param block_size Number of samples in a block
+ * @param block_count Number of blocks in ring buffer, at least 2
+ * @return true
+ * @return false
+ */
+bool adc_scan_start(const uint8_t *pins, uint8_t pin_count, adc_trigger trigger,
+                    uint8_t block_size, uint8_t block_count) {
+  if (pin_count == 0 || pin_count > ADC_MAX_PINS || block_size == 0 ||
+      block_count < 2) {
+    return false;
+  }
+  for (uint8_t i = 0; i < pin_count; i++) {
+    if (pins[i] < A0 || pins[i] > A5) {
+      return false;
+    }
+  }
+
+  if (!semaphore_take(adc_sem, 0)) {
+    return false;
+  }
+
+  uint16_t *buffer =
+      calloc((uint16_t)block_size * block_count, sizeof(*buffer));
+  if (buffer == NULL) {
+    semaphore_give(adc_sem);
+    return false;
+  }
+
+  uint8_t sreg = critical_enter();
+
+  for (uint8_t i = 0; i < pin_count; i++) {
+    adc_scan.pins[i] = pins[i] - A0;
+  }
+  adc_scan.pin_count = pin_count;
+  adc_scan.trigger = trigger;
+  adc_scan.conversion = 0;
+  adc_scan.next = 0;
+  adc_scan.expected = 0;
+  adc_scan.buffer = buffer;
+  adc_scan.block_size = block_size;
+  adc_scan.block_count = block_count;
+  adc_scan.write = 0;
+  adc_scan.read_block = 0;
+  adc_scan.filled = 0;
+  adc_scan.overruns = 0;
+  adc_scan.running = true;
+
+  ADMUX = adc_reference_bits | adc_scan.pins[0];
+  switch (trigger) {
+  case ADC_TRIGGER_FREE_RUNNING:
+    ADCSRB = 0;
+    ADCSRA = _BV(ADEN) | _BV(ADSC) | _BV(ADATE) | _BV(ADIE) | ADC_PRESCALER;
+    break;
+  case ADC_TRIGGER_TIMER0_COMPA:
+    ADCSRB = _BV(ADTS1) | _BV(ADTS0);
+    TIFR0 = _BV(OCF0A);
+    ADCSRA = _BV(ADEN) | _BV(ADATE) | _BV(ADIE) | ADC_PRESCALER;
+    break;
+  case ADC_TRIGGER_TIMER1_COMPB:
+    OCR1B = OCR1A / 2;
+    ADCSRB = _BV(ADTS2) | _BV(ADTS0);
+    TIFR1 = _BV(OCF1B);
+    ADCSRA = _BV(ADEN) | _BV(ADATE) | _BV(ADIE) | ADC_PRESCALER;
+    break;
+  }
+
+  critical_exit(sreg);
+  return true;
+}
+
+/**
+ * @brief Copy the oldest filled block of the scan
+ *
+ * @param block Buffer of block_size samples
+ * @param timeout Time of block or MAX_DELAY for suspending
+ * @return true
+ * @return false
+ */
+bool adc_scan_read(uint16_t *block, uint16_t timeout) {
+  uint8_t sreg = critical_enter();
+  if (timeout != MAX_DELAY) {
+    current_task->wake_tick = global_tick_count + timeout / 10;
   }
 
-  if (!task_queue_insert(&ready_tasks, task)) {
-    goto insert_error;
+  while (adc_scan.running && adc_scan.filled == 0) {
+    if (timeout != MAX_DELAY) {
+      if (TICK_REACHED(current_task->wake_tick)) {
+        critical_exit(sreg);
+        return false;
+      }
+      task_block(&adc_scan);
+    } else {
+      task_suspend_on(&adc_scan);
+    }
   }
 
-  return task;
+  if (!adc_scan.running) {
+    critical_exit(sreg);
+    return false;
+  }
 
-insert_error:
-  task_destroy(task);
-task_error:
-  return NULL;
+  memcpy(block,
+         adc_scan.buffer + (uint16_t)adc_scan.read_block * adc_scan.block_size,
+         adc_scan.block_size * sizeof(*block));
+  adc_scan.read_block = (adc_scan.read_block + 1) % adc_scan.block_count;
+  adc_scan.filled--;
+
+  critical_exit(sreg);
+  return true;
 }
 
 /**
- * @brief Deallocate tasks recourses
+ * @brief Number of blocks overwritten before they were read
  *
- * @param task Task handle
+ * @return uint8_t
  */
-void task_destroy(task_t task) {
-  cli();
+uint8_t adc_scan_overruns(void) { return adc_scan.overruns; }
 
-  if (task != NULL) {
-    switch (task->state) {
-    case READY:
-      task_queue_delete(&ready_tasks, task);
-      break;
-    case BLOCKED:
-      task_queue_delete(&blocked_tasks, task);
-      break;
-    case SUSPENDED:
-      task_queue_delete(&suspended_tasks, task);
-      break;
-    case RUNNING:
-      current_task = task_queue_top(&ready_tasks);
-      current_task->state = RUNNING;
-      RESTORE_CONTEXT();
-      asm volatile("reti");
-    }
+/**
+ * @brief Stop the scan and deallocate its buffer
+ *
+ */
+void adc_scan_stop(void) {
+  uint8_t sreg = critical_enter();
+  if (!adc_scan.running) {
+    critical_exit(sreg);
+    return;
+  }
+
+  ADCSRA = _BV(ADEN) | ADC_PRESCALER;
+  loop_until_bit_is_clear(ADCSRA, ADSC);
+  ADCSRA |= _BV(ADIF);
+
+  adc_scan.running = false;
+  free(adc_scan.buffer);
+  adc_scan.buffer = NULL;
+  task_wake(&adc_scan);
+  task_preempt(sreg);
+  critical_exit(sreg);
+
+  semaphore_give(adc_sem);
+}
+
+/**
+ * @brief Store a scanned sample, waking the readers when a block is filled
+ *
+ * @param value Result of conversion
+ */
+static void adc_scan_store(uint16_t value) {
+  uint16_t samples = (uint16_t)adc_scan.block_size * adc_scan.block_count;
 
-    free(task->stack);
-    free(task);
+  if (adc_scan.write % adc_scan.block_size == 0 &&
+      adc_scan.filled == adc_scan.block_count) {
+    adc_scan.read_block = (adc_scan.read_block + 1) % adc_scan.block_count;
+    adc_scan.filled--;
+    adc_scan.overruns++;
   }
 
-  sei();
+  adc_scan.buffer[adc_scan.write] = value;
+  adc_scan.write++;
+
+  if (adc_scan.write % adc_scan.block_size == 0) {
+    if (adc_scan.write == samples) {
+      adc_scan.write = 0;
+    }
+    adc_scan.filled++;
+    task_wake(&adc_scan);
+  }
 }
 
 /**
- * @brief Yield the execution of the task
+ * @brief ADC conversion complete ISR
  *
  */
-static void task_yield(void) __attribute__((naked));
-static void task_yield(void) {
-  SAVE_CONTEXT();
+KERNEL_ISR(ADC_vect) {
+  uint16_t value = ADC;
 
-  current_task = task_queue_top(&ready_tasks);
-  current_task->state = RUNNING;
+  if (!adc_scan.running) {
+    adc_value = value;
+    adc_done = true;
+    ADCSRA &= ~_BV(ADIE);
+    task_wake((void *)&adc_value);
+    return;
+  }
 
-  RESTORE_CONTEXT();
-  asm volatile("reti");
+  if (adc_scan.conversion == adc_scan.expected) {
+    adc_scan_store(value);
+    adc_scan.expected = (adc_scan.expected + 1) % adc_scan.pin_count;
+  }
+
+  // In free running mode the next conversion has already started with the
+  // current channel, so the channel set now is used by the one after it
+  if (adc_scan.trigger == ADC_TRIGGER_FREE_RUNNING) {
+    adc_scan.conversion = adc_scan.next;
+    adc_scan.next = (adc_scan.next + 1) % adc_scan.pin_count;
+    ADMUX = adc_reference_bits | adc_scan.pins[adc_scan.next];
+  } else {
+    adc_scan.conversion = (adc_scan.conversion + 1) % adc_scan.pin_count;
+    ADMUX = adc_reference_bits | adc_scan.pins[adc_scan.conversion];
+  }
+
+  if (adc_scan.trigger == ADC_TRIGGER_TIMER0_COMPA) {
+    TIFR0 = _BV(OCF0A);
+  } else if (adc_scan.trigger == ADC_TRIGGER_TIMER1_COMPB) {
+    TIFR1 = _BV(OCF1B);
+  }
 }
+#endif
 
+#if AVRTOS_USE_SPI
 /**
- * @brief Delay the task for specified milliseconds
+ * @brief Initialize the SPI driver as master
  *
- * @param ms Milliseconds to delay
+ * @param mode Clock polarity and phase
+ * @param clock Clock divider
  */
-void task_delay(uint16_t ms) {
-  cli();
-  current_task->wake_tick = global_tick_count + ms / 10;
-  current_task->state = BLOCKED;
-  task_queue_delete(&ready_tasks, current_task);
-  task_queue_insert(&blocked_tasks, current_task);
-  task_yield();
+void spi_init(spi_mode mode, spi_clock clock) {
+  static const uint8_t dividers[] = {
+      0, _BV(SPR0), _BV(SPR1), _BV(SPR1) | _BV(SPR0),
+  };
+
+  gpio_set_pin_mode(10, OUTPUT); // SS must be output to stay master
+  gpio_pin_write(10, HIGH);
+  gpio_set_pin_mode(11, OUTPUT); // MOSI
+  gpio_set_pin_mode(12, INPUT);  // MISO
+  gpio_set_pin_mode(13, OUTPUT); // SCK
+
+  // DIV2, DIV8 and DIV32 are DIV4, DIV16 and DIV64 at double speed
+  SPSR = (clock % 2 == 0 && clock != SPI_CLOCK_DIV128) ? _BV(SPI2X) : 0;
+  SPCR = _BV(SPE) | _BV(MSTR) | _BV(SPIE) | (mode << CPHA) |
+         dividers[clock / 2];
 }
 
 /**
- * @brief Block on channel
+ * @brief Select the device and send the first byte of transaction
  *
- * @param chan Channel to block on
+ * @param transaction Transaction at the head of queue
  */
-static void task_block(void *chan) {
-  current_task->channel = chan;
-  current_task->state = BLOCKED;
-  task_queue_delete(&ready_tasks, current_task);
-  task_queue_insert(&blocked_tasks, current_task);
-  task_yield();
+static void spi_start(spi_transaction_t *transaction) {
+  gpio_pin_write(transaction->cs_pin, LOW);
+  SPDR = transaction->tx ? transaction->tx[0] : 0xff;
 }
 
 /**
- * @brief Suspend on channel
+ * @brief Deselect the device of head transaction and start the next one
  *
- * @param chan Channel to suspend on
  */
-static void task_suspend(void *chan) {
-  current_task->channel = chan;
-  current_task->state = SUSPENDED;
-  task_queue_delete(&ready_tasks, current_task);
-  task_queue_insert(&suspended_tasks, current_task);
-  task_yield();
+static void spi_next(void) {
+  spi_transaction_t *transaction = spi_head;
+
+  gpio_pin_write(transaction->cs_pin, HIGH);
+  spi_head = transaction->next;
+  if (spi_head == NULL) {
+    spi_tail = NULL;
+  } else {
+    spi_start(spi_head);
+  }
 }
 
 /**
- * @brief Wake all the tasks blocked/suspended on channel
+ * @brief Queue a transfer and block until it completes. Bytes are clocked out
+ * from the SPI interrupt, so other tasks run during the transfer
  *
- * @param chan Block/Suspend channel
+ * @param cs_pin Chip select pin, driven low during the transfer
+ * @param tx Bytes to send, 0xff is sent if NULL
+ * @param rx Buffer for received bytes, discarded if NULL
+ * @param length Number of bytes
+ * @param timeout Time of block or MAX_DELAY for suspending
+ * @return true
+ * @return false
  */
-static void task_wake(void *chan) {
-  for (uint8_t i = 0; i < blocked_tasks.length; i++) {
-    task_t task = blocked_tasks.tasks[i];
-    if (task->channel == chan) {
-      task->state = READY;
-      task->channel = NULL;
-      task_queue_delete(&blocked_tasks, task);
-      task_queue_insert(&ready_tasks, task);
-      i--;
+bool spi_transfer(uint8_t cs_pin, const void *tx, void *rx, uint16_t length,
+                  uint16_t timeout) {
+  if (length == 0) {
+    return true;
+  }
+
+  spi_transaction_t transaction = {
+      .next = NULL,
+      .cs_pin = cs_pin,
+      .tx = tx,
+      .rx = rx,
+      .length = length,
+      .index = 0,
+      .done = false,
+  };
+
+  uint8_t sreg = critical_enter();
+  if (timeout != MAX_DELAY) {
+    current_task->wake_tick = global_tick_count + timeout / 10;
+  }
+
+  if (spi_tail == NULL) {
+    spi_head = &transaction;
+    spi_tail = &transaction;
+    spi_start(&transaction);
+  } else {
+    spi_tail->next = &transaction;
+    spi_tail = &transaction;
+  }
+
+  while (!transaction.done) {
+    if (timeout != MAX_DELAY) {
+      if (TICK_REACHED(current_task->wake_tick)) {
+        goto timeout_error;
+      }
+      task_block(&transaction);
+    } else {
+      task_suspend_on(&transaction);
     }
   }
 
-  for (uint8_t i = 0; i < suspended_tasks.length; i++) {
-    task_t task = suspended_tasks.tasks[i];
-    if (task->channel == chan) {
-      task->state = READY;
-      task->channel = NULL;
-      task_queue_delete(&suspended_tasks, task);
-      task_queue_insert(&ready_tasks, task);
-      i--;
+  critical_exit(sreg);
+  return true;
+
+timeout_error:
+  if (spi_head == &transaction) {
+    // Let the byte in flight finish so the next transaction can start
+    loop_until_bit_is_set(SPSR, SPIF);
+    (void)SPDR;
+    spi_next();
+  } else {
+    spi_transaction_t *prev = spi_head;
+    while (prev->next != &transaction) {
+      prev = prev->next;
+    }
+    prev->next = transaction.next;
+    if (spi_tail == &transaction) {
+      spi_tail = prev;
     }
   }
+  critical_exit(sreg);
+  return false;
 }
 
 /**
- * @brief Create a semaphore
+ * @brief SPI serial transfer complete ISR
  *
- * @param count Initial count of semaphore
- * @return semaphore_t
  */
-semaphore_t semaphore_init(uint8_t count) {
-  semaphore_t sem = malloc(sizeof(*sem));
-  if (sem == NULL) {
-    goto sem_error;
+KERNEL_ISR(SPI_STC_vect) {
+  spi_transaction_t *transaction = spi_head;
+  uint8_t byte = SPDR;
+
+  if (transaction == NULL) {
+    return;
   }
 
-  void *channel = malloc(1);
-  if (channel == NULL) {
-    goto chan_error;
+  if (transaction->rx) {
+    transaction->rx[transaction->index] = byte;
   }
+  transaction->index++;
 
-  sem->count = count;
-  sem->channel = channel;
+  if (transaction->index < transaction->length) {
+    SPDR = transaction->tx ? transaction->tx[transaction->index] : 0xff;
+    return;
+  }
 
-  return sem;
+  transaction->done = true;
+  spi_next();
+  task_wake(transaction);
+}
+#endif
 
-chan_error:
-  free(sem);
-sem_error:
-  return NULL;
+#if AVRTOS_USE_TWI
+/**
+ * @brief Initialize the TWI (I2C) driver as master
+ *
+ * @param frequency SCL frequency in Hz, 100000 or 400000
+ */
+void twi_init(uint32_t frequency) {
+  twi_sem = semaphore_init(1); // error handle
+
+  gpio_set_pin_mode(A4, INPUT_PULLUP); // SDA
+  gpio_set_pin_mode(A5, INPUT_PULLUP); // SCL
+
+  TWSR = 0;
+  TWBR = (F_CPU / frequency - 16) / 2;
+  TWCR = _BV(TWEN);
 }
 
 /**
- * @brief Wait to acquire semaphore. If timeout is MAX_DELAY suspend until
- * acquire, else block to acquire until timeout expires
+ * @brief Send stop condition and wake the task waiting for transfer
  *
- * @param sem Semaphore
+ * @param status Result of transfer
+ */
+static void twi_finish(twi_status status) {
+  twi_transfer_t *transfer = twi_current;
+
+  if (status == TWI_ARBITRATION_LOST) {
+    TWCR = _BV(TWINT) | _BV(TWEN);
+  } else {
+    TWCR = _BV(TWINT) | _BV(TWEN) | _BV(TWSTO);
+  }
+
+  twi_current = NULL;
+  transfer->status = status;
+  transfer->done = true;
+  task_wake(transfer);
+}
+
+/**
+ * @brief Do a transfer while holding the bus lock
+ *
+ * @param transfer Transfer to do
  * @param timeout Time of block or MAX_DELAY for suspending
- * @return true
- * @return false
+ * @return twi_status
  */
-bool semaphore_take(semaphore_t sem, uint16_t timeout) {
-  cli();
+static twi_status twi_transfer(twi_transfer_t *transfer, uint16_t timeout) {
+  uint8_t sreg = critical_enter();
+  tick_t deadline = global_tick_count + timeout / 10;
+  critical_exit(sreg);
+
+  if (!semaphore_take(twi_sem, timeout)) {
+    return TWI_TIMEOUT;
+  }
 
+  sreg = critical_enter();
   if (timeout != MAX_DELAY) {
-    current_task->wake_tick = global_tick_count + timeout / 10;
+    current_task->wake_tick = deadline; // waiting for the bus counts too
   }
 
-  while (sem->count == 0) {
+  twi_current = transfer;
+  TWCR = _BV(TWINT) | _BV(TWSTA) | _BV(TWEN) | _BV(TWIE);
+
+  while (!transfer->done) {
     if (timeout != MAX_DELAY) {
-      if (current_task->wake_tick <= global_tick_count) {
-        sei();
-        return false;
+      if (TICK_REACHED(current_task->wake_tick)) {
+        // Reset the TWI module to release the bus
+        TWCR = 0;
+        TWCR = _BV(TWEN);
+        twi_current = NULL;
+        transfer->status = TWI_TIMEOUT;
+        break;
       }
-      task_block(sem->channel);
+      task_block(transfer);
     } else {
-      task_suspend(sem->channel);
+      task_suspend_on(transfer);
     }
   }
 
-  sem->count--;
-  sei();
-  return true;
+  critical_exit(sreg);
+  semaphore_give(twi_sem);
+  return transfer->status;
 }
 
 /**
- * @brief Give back the semaphore
+ * @brief Write bytes to a slave. The task blocks until the transfer completes
  *
- * @param sem Semaphore
+ * @param address 7-bit slave address
+ * @param data Bytes to write
+ * @param length Number of bytes
+ * @param timeout Time of block or MAX_DELAY for suspending
+ * @return twi_status
  */
-void semaphore_give(semaphore_t sem) {
-  cli();
-  sem->count++;
-  task_wake(sem->channel);
-  sei();
+twi_status twi_write(uint8_t address, const void *data, uint8_t length,
+                     uint16_t timeout) {
+  return twi_write_read(address, data, length, NULL, 0, timeout);
 }
 
 /**
- * @brief Deallocate the resources of semaphore
+ * @brief Read bytes from a slave. The task blocks until the transfer completes
  *
- * @param sem Semaphore
+ * @param address 7-bit slave address
+ * @param data Buffer for read bytes
+ * @param length Number of bytes
+ * @param timeout Time of block or MAX_DELAY for suspending
+ * @return twi_status
  */
-void semaphore_destroy(semaphore_t sem) {
-  cli();
-  task_wake(sem->channel);
-  if (sem != NULL) {
-    free(sem->channel);
-    free(sem);
+twi_status twi_read(uint8_t address, void *data, uint8_t length,
+                    uint16_t timeout) {
+  return twi_write_read(address, NULL, 0, data, length, timeout);
+}
+
+/**
+ * @brief Write bytes then read bytes from a slave with a repeated start. The
+ * task blocks until the transfer completes
+ *
+ * @param address 7-bit slave address
+ * @param tx Bytes to write
+ * @param tx_length Number of bytes to write
+ * @param rx Buffer for read bytes
+ * @param rx_length Number of bytes to read
+ * @param timeout Time of block or MAX_DELAY for suspending
+ * @return twi_status
+ */
+twi_status twi_write_read(uint8_t address, const void *tx, uint8_t tx_length,
+                          void *rx, uint8_t rx_length, uint16_t timeout) {
+  twi_transfer_t transfer = {
+      .address = address,
+      .tx = tx,
+      .tx_length = tx_length,
+      .rx = rx,
+      .rx_length = rx_length,
+      .index = 0,
+      .reading = (tx_length == 0 && rx_length > 0),
+      .done = false,
+      .status = TWI_OK,
+  };
+
+  return twi_transfer(&transfer, timeout);
+}
+
+/**
+ * @brief TWI ISR, advances the transfer on every bus event
+ *
+ */
+KERNEL_ISR(TWI_vect) {
+  twi_transfer_t *transfer = twi_current;
+
+  if (transfer == NULL) {
+    TWCR = _BV(TWEN);
+    return;
+  }
+
+  switch (TWSR & 0xf8) {
+  case 0x08: // Start
+  case 0x10: // Repeated start
+    TWDR = (transfer->address << 1) | transfer->reading;
+    TWCR = _BV(TWINT) | _BV(TWEN) | _BV(TWIE);
+    break;
+  case 0x18: // Address acknowledged for write
+  case 0x28: // Data acknowledged
+    if (transfer->index < transfer->tx_length) {
+      TWDR = transfer->tx[transfer->index++];
+      TWCR = _BV(TWINT) | _BV(TWEN) | _BV(TWIE);
+    } else if (transfer->rx_length > 0) {
+      transfer->reading = true;
+      transfer->index = 0;
+      TWCR = _BV(TWINT) | _BV(TWSTA) | _BV(TWEN) | _BV(TWIE);
+    } else {
+      twi_finish(TWI_OK);
+    }
+    break;
+  case 0x20: // Address not acknowledged for write
+  case 0x48: // Address not acknowledged for read
+    twi_finish(TWI_ADDRESS_NACK);
+    break;
+  case 0x30: // Data not acknowledged
+    twi_finish(TWI_DATA_NACK);
+    break;
+  case 0x38: // Arbitration lost
+    twi_finish(TWI_ARBITRATION_LOST);
+    break;
+  case 0x50: // Data received, acknowledged
+    transfer->rx[transfer->index++] = TWDR;
+    // fall through
+  case 0x40: // Address acknowledged for read
+    if (transfer->index + 1 < transfer->rx_length) {
+      TWCR = _BV(TWINT) | _BV(TWEA) | _BV(TWEN) | _BV(TWIE);
+    } else {
+      TWCR = _BV(TWINT) | _BV(TWEN) | _BV(TWIE);
+    }
+    break;
+  case 0x58: // Data received, not acknowledged
+    transfer->rx[transfer->index++] = TWDR;
+    twi_finish(TWI_OK);
+    break;
+  default: // Bus error
+    twi_finish(TWI_BUS_ERROR);
+    break;
   }
-  sei();
 }
+#endif
 
+#if AVRTOS_USE_PWM
 /**
- * @brief Create a FIFO queue
+ * @brief Configure a timer for fast PWM. The frequency is
+ * F_CPU / (prescaler * (top + 1)) and duty cycles range from 0 to top. With a
+ * top other than 0xff the A pin of the timer is not available. Enabled pins
+ * stay connected when a timer is configured again
  *
- * @param capacity Capacity of queue
- * @param item_size Size of items going to be stored in queue
- * @return queue_t
+ * @param timer Timer
+ * @param prescaler Clock prescaler
+ * @param top Resolution of duty cycle
+ * @return true
+ * @return false if timer or prescaler is invalid for the timer
  */
-queue_t queue_init(uint8_t capacity, uint8_t item_size) {
-  queue_t queue = malloc(sizeof(*queue));
-  if (queue == NULL) {
-    goto queue_error;
+bool pwm_init(pwm_timer timer, pwm_prescaler prescaler, uint8_t top) {
+  static const uint8_t timer0_clocks[] = {1, 2, 0, 3, 0, 4, 5};
+  static const uint8_t timer2_clocks[] = {1, 2, 3, 4, 5, 6, 7};
+
+  if (timer > PWM_TIMER2 || prescaler > PWM_PRESCALER_1024) {
+    return false;
   }
 
-  queue->capacity = capacity;
-  queue->item_size = item_size;
-  queue->items = calloc(capacity, item_size);
-  queue->read_waiting = 0;
-  queue->write_waiting = 0;
-  queue->read_channel = malloc(1);
-  queue->write_channel = malloc(1);
+  uint8_t sreg = critical_enter();
+  if (timer == PWM_TIMER0) {
+    uint8_t clock = timer0_clocks[prescaler];
+    if (clock == 0) {
+      critical_exit(sreg);
+      return false;
+    }
 
-  if (queue->items == NULL) {
-    goto items_error;
+    // Keep enabled pins connected, pin A is lost when OCR0A holds the top
+    uint8_t com = TCCR0A & ((top == 0xff) ? _BV(COM0A1) | _BV(COM0B1)
+                                          : _BV(COM0B1));
+
+    // Fast PWM with top 0xff (mode 3) or OCR0A (mode 7)
+    OCR0A = (top == 0xff) ? 0 : top;
+    OCR0B = 0;
+    TCCR0A = com | _BV(WGM01) | _BV(WGM00);
+    TCCR0B = ((top == 0xff) ? 0 : _BV(WGM02)) | clock;
+  } else {
+    uint8_t clock = timer2_clocks[prescaler];
+
+    uint8_t com = TCCR2A & ((top == 0xff) ? _BV(COM2A1) | _BV(COM2B1)
+                                          : _BV(COM2B1));
+
+    // Fast PWM with top 0xff (mode 3) or OCR2A (mode 7)
+    OCR2A = (top == 0xff) ? 0 : top;
+    OCR2B = 0;
+    TCCR2A = com | _BV(WGM21) | _BV(WGM20);
+    TCCR2B = ((top == 0xff) ? 0 : _BV(WGM22)) | clock;
+  }
+
+  pwm_top[timer] = top;
+  critical_exit(sreg);
+
+  return true;
+}
+
+/**
+ * @brief Find the PWM channel of a pin
+ *
+ * @param pin Arduino pin
+ * @return const pwm_channel_t*
+ */
+static const pwm_channel_t *pwm_channel(uint8_t pin) {
+  for (uint8_t i = 0; i < sizeof(pwm_channels) / sizeof(pwm_channels[0]);
+       i++) {
+    const pwm_channel_t *channel = &pwm_channels[i];
+    if (channel->pin != pin) {
+      continue;
+    }
+    // Channel A holds the top of timer when it is not 0xff
+    if (channel->channel_a && pwm_top[channel->timer] != 0xff) {
+      return NULL;
+    }
+    return channel;
+  }
+  return NULL;
+}
+
+/**
+ * @brief Connect a pin to its PWM output
+ *
+ * @param pin One of 3, 5, 6, 11
+ * @return true
+ * @return false
+ */
+bool pwm_enable(uint8_t pin) {
+  const pwm_channel_t *channel = pwm_channel(pin);
+  if (channel == NULL) {
+    return false;
+  }
+
+  gpio_set_pin_mode(pin, OUTPUT);
+
+  uint8_t sreg = critical_enter();
+  *channel->tccr |= channel->com;
+  critical_exit(sreg);
+
+  return true;
+}
+
+/**
+ * @brief Set the duty cycle of a pin. The new value takes effect at the start
+ * of the next period, so updates never glitch. Can be called from ISRs
+ *
+ * @warning Fast PWM still gives a one timer clock pulse every period at a
+ * duty of 0, use pwm_disable for a steady low
+ *
+ * @param pin One of 3, 5, 6, 11
+ * @param duty Duty cycle from 0 to top
+ */
+void pwm_write(uint8_t pin, uint8_t duty) {
+  const pwm_channel_t *channel = pwm_channel(pin);
+  if (channel == NULL) {
+    return;
+  }
+
+  if (duty > pwm_top[channel->timer]) {
+    duty = pwm_top[channel->timer];
+  }
+  *channel->ocr = duty;
+}
+
+/**
+ * @brief Disconnect a pin from its PWM output and drive it low
+ *
+ * @param pin One of 3, 5, 6, 11
+ */
+void pwm_disable(uint8_t pin) {
+  const pwm_channel_t *channel = pwm_channel(pin);
+  if (channel == NULL) {
+    return;
   }
 
-  return queue;
+  uint8_t sreg = critical_enter();
+  *channel->tccr &= ~channel->com;
+  critical_exit(sreg);
 
-items_error:
-  free(queue);
-queue_error:
-  return NULL;
+  gpio_pin_write(pin, LOW);
 }
+#endif
 
+#if AVRTOS_USE_GPIO_IRQ
 /**
- * @brief Send to back of queue
+ * @brief Deliver the edges of a pin to waiting tasks and a callback. Pins 2
+ * and 3 use INT0 and INT1, the other pins use pin change interrupts
  *
- * @param queue Message queue
- * @param item Message
- * @param timeout Timeout
- * @returns bool
+ * @param pin Pin to watch, 0 - 13 or A0 - A5
+ * @param edge Edges to deliver
+ * @param debounce Milliseconds to ignore edges after a delivered one
+ * @param callback Called from the ISR for every delivered edge, can be NULL
+ * @return true
+ * @return false
  */
-bool queue_send(queue_t queue, void *item, uint16_t timeout) {
-  cli();
-  if (timeout != MAX_DELAY) {
-    current_task->wake_tick = global_tick_count + timeout / 10;
+bool gpio_irq_attach(uint8_t pin, gpio_edge edge, uint16_t debounce,
+                     void (*callback)(const gpio_event_t *)) {
+  if (pin > A5) {
+    return false;
   }
-  queue->write_waiting++;
 
-  while (queue->length == queue->capacity) {
-    if (timeout != MAX_DELAY) {
-      if (current_task->wake_tick <= global_tick_count) {
-        queue->write_waiting--;
-        sei();
-        return false;
-      }
-      task_block(queue->write_channel);
-    } else {
-      task_suspend(queue->write_channel);
-    }
+  gpio_irq_t *irq = malloc(sizeof(*irq));
+  if (irq == NULL) {
+    return false;
   }
 
-  memcpy(queue->items + queue->length * queue->item_size, item,
-         queue->item_size);
-  queue->length++;
-  queue->write_waiting--;
+  irq->edge = edge;
+  irq->debounce = (debounce + 9) / 10;
+  irq->delivered = false;
+  irq->pending = false;
+  irq->callback = callback;
 
-  if (queue->read_waiting) {
-    task_wake(queue->read_channel);
+  uint8_t sreg = critical_enter();
+  gpio_irq_t *old = gpio_irqs[pin];
+  gpio_irqs[pin] = irq;
+
+  if (pin == 2 || pin == 3) {
+    static const uint8_t modes[] = {0x3, 0x2, 0x1}; // ISCn1:ISCn0 of edges
+    uint8_t shift = (pin == 2) ? ISC00 : ISC10;
+    uint8_t bit = (pin == 2) ? INT0 : INT1;
+
+    EICRA = (EICRA & ~(0x3 << shift)) | (modes[edge] << shift);
+    EIFR = _BV(bit);
+    EIMSK |= _BV(bit);
+  } else if (pin < 8) {
+    gpio_pcint_levels[2] = PIND;
+    PCMSK2 |= _BV(pin);
+    PCICR |= _BV(PCIE2);
+  } else if (pin < 14) {
+    gpio_pcint_levels[0] = PINB;
+    PCMSK0 |= _BV(pin - 8);
+    PCICR |= _BV(PCIE0);
+  } else {
+    gpio_pcint_levels[1] = PINC;
+    PCMSK1 |= _BV(pin - 14);
+    PCICR |= _BV(PCIE1);
+  }
+
+  if (old != NULL) {
+    task_wake(old);
+    free(old);
   }
+  task_preempt(sreg);
+  critical_exit(sreg);
 
-  sei();
   return true;
 }
 
 /**
- * @brief Receive from front of the queue
+ * @brief Wait for the next edge of a pin. An edge delivered while no task was
+ * waiting is kept until it is read
  *
- * @param queue Message queue
- * @param item Message
- * @param timeout Timeout
- * @return bool
+ * @param pin Attached pin
+ * @param event Delivered edge
+ * @param timeout Time of block or MAX_DELAY for suspending
+ * @return true
+ * @return false
  */
-bool queue_receive(queue_t queue, void *item, uint16_t timeout) {
-  cli();
+bool gpio_irq_wait(uint8_t pin, gpio_event_t *event, uint16_t timeout) {
+  if (pin > A5) {
+    return false;
+  }
+
+  uint8_t sreg = critical_enter();
   if (timeout != MAX_DELAY) {
     current_task->wake_tick = global_tick_count + timeout / 10;
   }
-  queue->read_waiting++;
 
-  while (queue->length == 0) {
+  gpio_irq_t *irq = gpio_irqs[pin];
+  while (irq != NULL && !irq->pending) {
     if (timeout != MAX_DELAY) {
-      if (current_task->wake_tick <= global_tick_count) {
-        queue->read_waiting--;
-        sei();
+      if (TICK_REACHED(current_task->wake_tick)) {
+        critical_exit(sreg);
         return false;
       }
-      task_block(queue->read_channel);
+      task_block(irq);
     } else {
-      task_suspend(queue->read_channel);
+      task_suspend_on(irq);
     }
+    irq = gpio_irqs[pin];
   }
 
-  queue->length--;
-  memcpy(item, queue->items, queue->item_size);
-  memmove(queue->items, queue->items + queue->item_size,
-          queue->item_size * queue->length);
-  memset(queue->items + queue->item_size * queue->length, 0, queue->item_size);
-  queue->read_waiting--;
-
-  if (queue->write_waiting) {
-    task_wake(queue->write_channel);
+  if (irq == NULL) {
+    critical_exit(sreg);
+    return false;
   }
 
-  sei();
+  *event = irq->event;
+  irq->pending = false;
+  critical_exit(sreg);
   return true;
 }
 
 /**
- * @brief Deallocate queues resources
+ * @brief Stop delivering the edges of a pin
  *
- * @param queue Queue to deallocate
+ * @param pin Attached pin
  */
-void queue_destroy(queue_t queue) {
-  cli();
-  task_wake(queue->read_channel);
-  task_wake(queue->write_channel);
+void gpio_irq_detach(uint8_t pin) {
+  if (pin > A5) {
+    return;
+  }
 
-  if (queue) {
-    free(queue->write_channel);
-    free(queue->read_channel);
-    free(queue->items);
-    free(queue);
+  uint8_t sreg = critical_enter();
+  gpio_irq_t *irq = gpio_irqs[pin];
+  if (irq == NULL) {
+    critical_exit(sreg);
+    return;
   }
-  sei();
-}
 
-/**
- * @brief Wake up expired tasks
- *
- */
-static void wake_expired_tasks(void) {
-  for (uint8_t i = 0; i < blocked_tasks.length; i++) {
-    task_t task = blocked_tasks.tasks[i];
-    if (task->wake_tick <= global_tick_count) {
-      task->state = READY;
-      task_queue_delete(&blocked_tasks, task);
-      task_queue_insert(&ready_tasks, task);
-      i--;
-    }
+  if (pin == 2) {
+    EIMSK &= ~_BV(INT0);
+  } else if (pin == 3) {
+    EIMSK &= ~_BV(INT1);
+  } else if (pin < 8) {
+    PCMSK2 &= ~_BV(pin);
+  } else if (pin < 14) {
+    PCMSK0 &= ~_BV(pin - 8);
+  } else {
+    PCMSK1 &= ~_BV(pin - 14);
   }
+
+  gpio_irqs[pin] = NULL;
+  task_wake(irq);
+  free(irq);
+  task_preempt(sreg);
+  critical_exit(sreg);
 }
 
 /**
- * @brief Timer interrupt ISR
+ * @brief Deliver an edge of a pin if it matches the edge and debounce time
  *
+ * @param pin Pin of the edge
+ * @param value Level of pin after the edge
+ * @param time Timer 1 count at the start of ISR
  */
-ISR(TIMER1_COMPA_vect, ISR_NAKED) {
-  SAVE_CONTEXT();
-
-  global_tick_count++;
-  if (global_tick_count % 100 == 0) {
-    system_tick();
+static void gpio_irq_deliver(uint8_t pin, uint8_t value, uint16_t time) {
+  gpio_irq_t *irq = gpio_irqs[pin];
+  if (irq == NULL) {
+    return;
   }
 
-  wake_expired_tasks();
+  if ((irq->edge == GPIO_EDGE_RISING && !value) ||
+      (irq->edge == GPIO_EDGE_FALLING && value)) {
+    return;
+  }
 
-  current_task->state = READY;
-  task_queue_delete(&ready_tasks, current_task);
-  task_queue_insert(&ready_tasks, current_task);
+  if (irq->delivered &&
+      (tick_t)(global_tick_count - irq->event.tick) < irq->debounce) {
+    return;
+  }
 
-  current_task = task_queue_top(&ready_tasks);
-  current_task->state = RUNNING;
+  irq->event.pin = pin;
+  irq->event.value = value;
+  irq->event.tick = global_tick_count;
+  irq->event.time = time;
+  irq->delivered = true;
+  irq->pending = true;
 
-  RESTORE_CONTEXT();
-  asm volatile("reti");
+  if (irq->callback) {
+    irq->callback(&irq->event);
+  }
+  task_wake(irq);
 }
 
 /**
- * @brief Set the timer interrupt object
+ * @brief Deliver the edges of pins that changed in a pin change group
  *
+ * @param group Index of port levels, 0 for B, 1 for C and 2 for D
+ * @param levels Current levels of port
+ * @param mask Pins of port with pin change interrupt enabled
+ * @param first_pin Arduino pin of the first bit of port
+ * @param time Timer 1 count at the start of ISR
  */
-static void set_timer_interrupt(void) {
-  TCCR1B = (1 << CS10) | (1 << CS12) | (1 << WGM12);
-  OCR1A = 16000000 / 1024 / 100; // 10ms
-  TIMSK1 = (1 << OCIE1A);
-  sei();
+static void gpio_pcint_deliver(uint8_t group, uint8_t levels, uint8_t mask,
+                               uint8_t first_pin, uint16_t time) {
+  uint8_t changed = (levels ^ gpio_pcint_levels[group]) & mask;
+  gpio_pcint_levels[group] = levels;
+
+  for (uint8_t bit = 0; changed; bit++, changed >>= 1) {
+    if (changed & 1) {
+      gpio_irq_deliver(first_pin + bit, (levels >> bit) & 1, time);
+    }
+  }
 }
 
 /**
- * @brief Idle task function
+ * @brief External interrupt 0 ISR (pin 2)
  *
- * @param arg
  */
-static void idle_task_fn(void *arg) {
-  (void)arg;
-  for (;;)
-    ;
+KERNEL_ISR(INT0_vect) {
+  uint16_t time = TCNT1;
+  gpio_irq_deliver(2, (PIND >> PD2) & 1, time);
 }
 
 /**
- * @brief Start scheduler
+ * @brief External interrupt 1 ISR (pin 3)
  *
- * @warning If initialization is successful this function does not return
  */
-void scheduler_init(void) {
-  task_t idle_task = task_init(idle_task_fn, NULL, "idle task", 64, 0);
-  if (idle_task == NULL) {
-    return;
-  }
-
-  current_task = idle_task;
-  set_timer_interrupt();
+KERNEL_ISR(INT1_vect) {
+  uint16_t time = TCNT1;
+  gpio_irq_deliver(3, (PIND >> PD3) & 1, time);
+}
 
-  for (;;)
-    ;
+/**
+ * @brief Pin change interrupt ISR of port B (pins 8 - 13)
+ *
+ */
+KERNEL_ISR(PCINT0_vect) {
+  uint16_t time = TCNT1;
+  gpio_pcint_deliver(0, PINB, PCMSK0, 8, time);
 }
 
 /**
- * @brief Write a character in stream
+ * @brief Pin change interrupt ISR of port C (pins A0 - A5)
  *
- * @param c Character to write
- * @param stream Stream to write
- * @return int
  */
-static int uart_putchar(char c, FILE *stream) {
-  if (c == '\n') {
-    uart_putchar('\r', stream);
-  }
-  loop_until_bit_is_set(UCSR0A, UDRE0);
-  UDR0 = c;
-  return 0;
+KERNEL_ISR(PCINT1_vect) {
+  uint16_t time = TCNT1;
+  gpio_pcint_deliver(1, PINC, PCMSK1, A0, time);
 }
 
 /**
- * @brief Read a character from stream
+ * @brief Pin change interrupt ISR of port D (pins 0 - 7)
  *
- * @param stream Stream to read
- * @return int
  */
-static int uart_getchar(FILE *stream) {
-  (void)stream;
-  loop_until_bit_is_set(UCSR0A, RXC0);
-  return UDR0;
+KERNEL_ISR(PCINT2_vect) {
+  uint16_t time = TCNT1;
+  gpio_pcint_deliver(2, PIND, PCMSK2, 0, time);
 }
+#endif
 
-static FILE uart_output =
-    FDEV_SETUP_STREAM(uart_putchar, NULL, _FDEV_SETUP_WRITE);
-static FILE uart_input =
-    FDEV_SETUP_STREAM(NULL, uart_getchar, _FDEV_SETUP_READ);
+#if AVRTOS_USE_EEPROM
+/**
+ * @brief Read a byte directly from EEPROM
+ *
+ * @warning EEPROM must not be writing
+ *
+ * @param address EEPROM address
+ * @return uint8_t
+ */
+static uint8_t eeprom_read_byte_now(uint16_t address) {
+  EEAR = address;
+  EECR |= _BV(EERE);
+  return EEDR;
+}
 
 /**
- * @brief Initialize the UART driver
+ * @brief Queue bytes to be written to EEPROM in the background. Bytes equal
+ * to the EEPROM content are skipped and queued writes to the same address are
+ * merged
+ *
+ * @warning On timeout the bytes queued before it are still written, the
+ * EEPROM may hold a part of data
  *
+ * @param address EEPROM address
+ * @param data Bytes to write
+ * @param length Number of bytes
+ * @param timeout Time of block or MAX_DELAY for suspending while queue is full
+ * @return true
+ * @return false if timeout occurred
  */
-void uart_init(void) {
-  uart_sem = semaphore_init(1); // error handle
+bool eeprom_write(uint16_t address, const void *data, uint16_t length,
+                  uint16_t timeout) {
+  const uint8_t *bytes = data;
 
-  UBRR0H = UBRRH_VALUE;
-  UBRR0L = UBRRL_VALUE;
+  uint8_t sreg = critical_enter();
+  if (timeout != MAX_DELAY) {
+    current_task->wake_tick = global_tick_count + timeout / 10;
+  }
 
-  UCSR0B = _BV(RXEN0) | _BV(TXEN0);
-  UCSR0C = _BV(UCSZ01) | _BV(UCSZ00);
+  for (uint16_t i = 0; i < length; i++) {
+    uint16_t byte_address = address + i;
+    bool merged = false;
 
-  stdout = &uart_output;
-  stdin = &uart_input;
+    // The entry being written cannot be changed anymore
+    for (uint8_t j = eeprom_writing; j < eeprom_length; j++) {
+      eeprom_entry_t *entry =
+          &eeprom_queue[(eeprom_head + j) % AVRTOS_EEPROM_QUEUE_SIZE];
+      if (entry->address == byte_address) {
+        entry->value = bytes[i];
+        merged = true;
+        break;
+      }
+    }
+    if (merged) {
+      continue;
+    }
+
+    while (eeprom_length == AVRTOS_EEPROM_QUEUE_SIZE) {
+      if (timeout != MAX_DELAY) {
+        if (TICK_REACHED(current_task->wake_tick)) {
+          critical_exit(sreg);
+          return false;
+        }
+        task_block(eeprom_queue);
+      } else {
+        task_suspend_on(eeprom_queue);
+      }
+    }
+
+    eeprom_entry_t *entry =
+        &eeprom_queue[(eeprom_head + eeprom_length) % AVRTOS_EEPROM_QUEUE_SIZE];
+    entry->address = byte_address;
+    entry->value = bytes[i];
+    eeprom_length++;
+
+    if (!eeprom_readers) {
+      EECR |= _BV(EERIE);
+    }
+  }
+
+  critical_exit(sreg);
+  return true;
 }
 
 /**
- * @brief Set pin mode
+ * @brief Read bytes from EEPROM, including the queued writes
  *
- * @param pin
- * @param mode
+ * @param address EEPROM address
+ * @param data Buffer for read bytes
+ * @param length Number of bytes
  */
-void gpio_set_pin_mode(uint8_t pin, gpio_pin_mode mode) {
-  uint8_t direction = (mode == OUTPUT);
-  uint8_t pin_value = (mode == INPUT_PULLUP);
+void eeprom_read(uint16_t address, void *data, uint16_t length) {
+  uint8_t *bytes = data;
 
-  if (pin < 8) {
-    PORTD |= (pin_value << pin);
-    DDRD |= (direction << pin);
-  } else if (pin < 14) {
-    PORTB |= (pin_value << (pin - 8));
-    DDRB |= (direction << (pin - 8));
-  } else if (pin <= A5) {
-    PORTC |= (pin_value << (pin - 14));
-    DDRC |= (direction << (pin - 14));
+  uint8_t sreg = critical_enter();
+
+  // Writing is paused by the ISR when the current byte is done
+  eeprom_readers++;
+  while (EECR & _BV(EEPE)) {
+    task_suspend_on(eeprom_queue);
+  }
+
+  for (uint16_t i = 0; i < length; i++) {
+    bytes[i] = eeprom_read_byte_now(address + i);
   }
+
+  for (uint8_t j = 0; j < eeprom_length; j++) {
+    eeprom_entry_t *entry =
+        &eeprom_queue[(eeprom_head + j) % AVRTOS_EEPROM_QUEUE_SIZE];
+    if (entry->address >= address && entry->address - address < length) {
+      bytes[entry->address - address] = entry->value;
+    }
+  }
+
+  eeprom_readers--;
+  if (!eeprom_readers && eeprom_length) {
+    EECR |= _BV(EERIE);
+  }
+
+  critical_exit(sreg);
 }
 
 /**
- * @brief Write low or high to a pin
+ * @brief Wait until all queued writes are done
  *
- * @param pin
- * @param value
+ * @param timeout Time of block or MAX_DELAY for suspending
+ * @return true
+ * @return false
  */
-void gpio_pin_write(uint8_t pin, uint8_t value) {
-  if (pin < 8) {
-    if (value) {
-      PORTD = PORTD | (1 << pin);
-    } else {
-      PORTD = PORTD & (0 << pin);
-    }
-  } else if (pin < 14) {
-    if (value) {
-      PORTB = PORTB | (1 << (pin - 8));
-    } else {
-      PORTB = PORTB & (0 << (pin - 8));
-    }
-  } else if (pin <= A5) {
-    if (value) {
-      PORTC = PORTC | (1 << (pin - 14));
+bool eeprom_flush(uint16_t timeout) {
+  uint8_t sreg = critical_enter();
+  if (timeout != MAX_DELAY) {
+    current_task->wake_tick = global_tick_count + timeout / 10;
+  }
+
+  while (eeprom_length) {
+    if (timeout != MAX_DELAY) {
+      if (TICK_REACHED(current_task->wake_tick)) {
+        critical_exit(sreg);
+        return false;
+      }
+      task_block(eeprom_queue);
     } else {
-      PORTC = PORTC & (0 << (pin - 14));
+      task_suspend_on(eeprom_queue);
     }
   }
+
+  critical_exit(sreg);
+  return true;
 }
 
 /**
- * @brief Read the pin
+ * @brief EEPROM ready ISR, starts writing the next changed byte in queue
  *
- * @param pin
- * @return uint8_t
  */
-uint8_t gpio_pin_read(uint8_t pin) {
-  uint8_t value = 0;
+KERNEL_ISR(EE_READY_vect) {
+  if (eeprom_writing) {
+    eeprom_head = (eeprom_head + 1) % AVRTOS_EEPROM_QUEUE_SIZE;
+    eeprom_length--;
+    eeprom_writing = false;
+    task_wake(eeprom_queue);
+  }
 
-  if (pin < 8) {
-    value = PIND & (1 << pin);
-  } else if (pin < 14) {
-    value = PINB & (1 << (pin - 8));
-  } else if (pin <= A5) {
-    value = PINC & (1 << (pin - 14));
+  if (eeprom_readers) {
+    EECR &= ~_BV(EERIE);
+    task_wake(eeprom_queue);
+    return;
   }
 
-  return value;
-}
+  while (eeprom_length) {
+    eeprom_entry_t *entry = &eeprom_queue[eeprom_head];
 
-int print(const char *fmt, ...) {
-  semaphore_take(uart_sem, MAX_DELAY);
-  va_list args;
-  va_start(args, fmt);
+    if (eeprom_read_byte_now(entry->address) != entry->value) {
+      EEDR = entry->value;
+      EECR |= _BV(EEMPE);
+      EECR |= _BV(EEPE);
+      eeprom_writing = true;
+      return;
+    }
 
-  int bytes = vprintf(fmt, args);
+    eeprom_head = (eeprom_head + 1) % AVRTOS_EEPROM_QUEUE_SIZE;
+    eeprom_length--;
+  }
 
-  va_end(args);
-  semaphore_give(uart_sem);
-  return bytes;
+  EECR &= ~_BV(EERIE);
+  task_wake(eeprom_queue);
 }
+#endif
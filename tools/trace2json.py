@@ -0,0 +1,107 @@
+#!/usr/bin/env python3
+"""Convert an AVRtos trace capture into Chrome trace JSON.
+
+Capture the UART output of trace_dump or of stream mode into a file, e.g.
+    stty -F /dev/ttyUSB0 raw 9600 && cat /dev/ttyUSB0 > trace.bin
+then convert it and open the result in chrome://tracing or ui.perfetto.dev
+    python3 tools/trace2json.py trace.bin > trace.json
+"""
+
+import argparse
+import json
+import struct
+import sys
+
+SYNC = 0xA5
+RECORD = struct.Struct("<BBHH")
+
+EVENTS = [
+    "tick",
+    "task_create",
+    "switch",
+    "block",
+    "suspend",
+    "wake",
+    "sem_take",
+    "sem_give",
+    "queue_send",
+    "queue_receive",
+    "user",
+]
+TICK, TASK_CREATE, SWITCH = 0, 1, 2
+USER = 10
+
+
+def records(data):
+    """Yield the records of a capture, resynchronizing on corrupt bytes."""
+    i = 0
+    while i + 1 + RECORD.size <= len(data):
+        if data[i] != SYNC:
+            i += 1
+            continue
+        event, task, time, obj = RECORD.unpack_from(data, i + 1)
+        if event >= len(EVENTS):
+            i += 1
+            continue
+        yield event, task, time, obj
+        i += 1 + RECORD.size
+
+
+def convert(data, tick_us, count_us):
+    events = []
+    tick = None
+    last_tick = 0
+    running = None
+    timestamp = 0.0
+
+    for event, task, time, obj in records(data):
+        if event == TICK:
+            if tick is None:
+                tick = obj
+            else:
+                tick += (obj - last_tick) & 0xFFFF  # unwrap 16 bits
+            last_tick = obj
+        if tick is None:
+            continue
+        timestamp = tick * tick_us + time * count_us
+
+        if event == TICK:
+            continue
+        if event == SWITCH:
+            if running is not None:
+                events.append({"name": "task %d" % running, "ph": "E",
+                               "pid": 0, "tid": running, "ts": timestamp})
+            running = task
+            events.append({"name": "task %d" % task, "ph": "B", "pid": 0,
+                           "tid": task, "ts": timestamp})
+        elif event == USER:
+            events.append({"name": "user %d" % task, "ph": "i", "s": "p",
+                           "pid": 0, "tid": 256, "ts": timestamp,
+                           "args": {"value": obj}})
+        else:
+            events.append({"name": EVENTS[event], "ph": "i", "s": "t",
+                           "pid": 0, "tid": task, "ts": timestamp,
+                           "args": {"object": "0x%04x" % obj}})
+
+    if running is not None:
+        events.append({"name": "task %d" % running, "ph": "E", "pid": 0,
+                       "tid": running, "ts": timestamp})
+    return {"traceEvents": events, "displayTimeUnit": "ms"}
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("capture", help="binary capture of the UART")
+    parser.add_argument("--tick-us", type=float, default=10000,
+                        help="microseconds per tick (default 10000)")
+    parser.add_argument("--count-us", type=float, default=0.5,
+                        help="microseconds per timer 1 count (default 0.5)")
+    args = parser.parse_args()
+
+    with open(args.capture, "rb") as f:
+        data = f.read()
+    json.dump(convert(data, args.tick_us, args.count_us), sys.stdout)
+
+
+if __name__ == "__main__":
+    main()